@@ -0,0 +1,229 @@
+/*
+    Labyrinth
+    Benedict Henshaw, 2018
+    bitbench.c - Timing how quickly values are packed and unpacked.
+*/
+
+// "/bitbench" packs a few million values of every kind that bits.c offers,
+// reads them all back, and reports the time each took per field, so that a
+// change to bits.c, or to how a message is laid out, can be judged by numbers
+// rather than by guesses. Each kind is run through a schema of four fields of
+// that kind, and then a whole player's state is run through one schema, as a
+// snapshot would write it. Everything read back is packed again and checked
+// against the first packing; a mismatch means the writer and reader disagree.
+//
+// It then reports bytes per snapshot: the average size of the snapshots the
+// server has sent so far, and the size of a snapshot that brings a client
+// with no baseline fully up to date, as large as a snapshot may be, for each
+// player in turn. Those are written for clients made just for the benchmark,
+// which have sent input as a real one would, so that their own player's state
+// is included. No real client is disturbed, and the time taken to write each
+// is shown too, along with any that would not fit.
+//
+// The values are random, but from a generator of the benchmark's own, so that
+// running it does not change what happens in the match.
+
+#define BITBENCH_RECORDS 4096
+#define BITBENCH_ROUNDS 64
+#define BITBENCH_MAX_SNAPSHOTS 64
+
+typedef struct
+{
+    u32 sequence[4];
+    s32 index[4];
+    f32 angle[4];
+    u32 count[4];
+    bool flag[4];
+    f32 exact[4];
+    Entity_State entity;
+}
+Bench_Record;
+
+#define BENCH_BITS_SCHEMA(BITS, RANGED, QUANTIZED, VARINT, FLAG, EXACT) \
+    BITS(sequence[0], 16) BITS(sequence[1], 16) BITS(sequence[2], 16) BITS(sequence[3], 16)
+#define BENCH_RANGED_SCHEMA(BITS, RANGED, QUANTIZED, VARINT, FLAG, EXACT) \
+    RANGED(index[0], -1, PLAYER_LIMIT - 1) RANGED(index[1], -1, PLAYER_LIMIT - 1) \
+    RANGED(index[2], -1, PLAYER_LIMIT - 1) RANGED(index[3], -1, PLAYER_LIMIT - 1)
+#define BENCH_QUANTIZED_SCHEMA(BITS, RANGED, QUANTIZED, VARINT, FLAG, EXACT) \
+    QUANTIZED(angle[0], -PI, PI, ANGLE_BITS) QUANTIZED(angle[1], -PI, PI, ANGLE_BITS) \
+    QUANTIZED(angle[2], -PI, PI, ANGLE_BITS) QUANTIZED(angle[3], -PI, PI, ANGLE_BITS)
+#define BENCH_VARINT_SCHEMA(BITS, RANGED, QUANTIZED, VARINT, FLAG, EXACT) \
+    VARINT(count[0]) VARINT(count[1]) VARINT(count[2]) VARINT(count[3])
+#define BENCH_FLAG_SCHEMA(BITS, RANGED, QUANTIZED, VARINT, FLAG, EXACT) \
+    FLAG(flag[0]) FLAG(flag[1]) FLAG(flag[2]) FLAG(flag[3])
+#define BENCH_EXACT_SCHEMA(BITS, RANGED, QUANTIZED, VARINT, FLAG, EXACT) \
+    EXACT(exact[0]) EXACT(exact[1]) EXACT(exact[2]) EXACT(exact[3])
+
+DEFINE_SCHEMA(bench_bits, Bench_Record, BENCH_BITS_SCHEMA)
+DEFINE_SCHEMA(bench_ranged, Bench_Record, BENCH_RANGED_SCHEMA)
+DEFINE_SCHEMA(bench_quantized, Bench_Record, BENCH_QUANTIZED_SCHEMA)
+DEFINE_SCHEMA(bench_varint, Bench_Record, BENCH_VARINT_SCHEMA)
+DEFINE_SCHEMA(bench_flag, Bench_Record, BENCH_FLAG_SCHEMA)
+DEFINE_SCHEMA(bench_exact, Bench_Record, BENCH_EXACT_SCHEMA)
+
+// Every field of a player, as a snapshot with no baseline would send it.
+#define BENCH_ENTITY_SCHEMA(BITS, RANGED, QUANTIZED, VARINT, FLAG, EXACT) \
+    BITS(entity.x, position_bits()) BITS(entity.y, position_bits()) BITS(entity.angle, ANGLE_BITS) \
+    BITS(entity.sprite_index, SPRITE_INDEX_BITS) FLAG(entity.visible)
+
+DEFINE_SCHEMA(bench_entity, Bench_Record, BENCH_ENTITY_SCHEMA)
+
+typedef struct
+{
+    char * name;
+    void (* write)(Bit_Writer * writer, Bench_Record * record);
+    void (* read)(Bit_Reader * reader, Bench_Record * record);
+    int (* bits)();
+    int (* field_count)();
+}
+Bench_Schema;
+
+#define BENCH_SCHEMA(name) \
+    { #name, write_bench_##name, read_bench_##name, bench_##name##_bits, bench_##name##_field_count }
+
+Bench_Schema bench_schemas[] = {
+    BENCH_SCHEMA(bits),
+    BENCH_SCHEMA(ranged),
+    BENCH_SCHEMA(quantized),
+    BENCH_SCHEMA(varint),
+    BENCH_SCHEMA(flag),
+    BENCH_SCHEMA(exact),
+    BENCH_SCHEMA(entity),
+};
+
+void fill_bench_records(Bench_Record * records, u64 seed[2])
+{
+    for (int r = 0; r < BITBENCH_RECORDS; ++r)
+    {
+        Bench_Record * record = records + r;
+        for (int i = 0; i < 4; ++i)
+        {
+            u64 random = random_u64_from(seed);
+            record->sequence[i] = random & 0xFFFF;
+            record->index[i] = (s32)((random >> 16) % (PLAYER_LIMIT + 1)) - 1;
+            record->angle[i] = dequantize_angle((random >> 24) % (1 << ANGLE_BITS));
+            // Mostly small, as counts and gaps are, with the odd large one.
+            record->count[i] = (u32)(random >> 32) >> ((random >> 8) % 32);
+            record->flag[i] = random >> 63;
+            record->exact[i] = (f32)(random % 100000) / 1000.0f - 50.0f;
+        }
+        u64 random = random_u64_from(seed);
+        record->entity = (Entity_State){
+            .x = random % (1u << position_bits()),
+            .y = (random >> 24) % (1u << position_bits()),
+            .angle = (random >> 48) % (1 << ANGLE_BITS),
+            .sprite_index = (random >> 40) % PLAYER_SPRITE_COUNT,
+            .visible = random >> 63,
+        };
+    }
+}
+
+// Pack and unpack every record, BITBENCH_ROUNDS times over, and report the
+// time per field. Returns false if what was read back does not pack to the
+// same bits as what was written.
+bool time_schema(Bench_Schema * schema, Bench_Record * records, Bench_Record * decoded, u8 * buffer)
+{
+    int capacity = BITBENCH_RECORDS * ((schema->bits() + 7) / 8) + 8;
+    u8 * repacked = buffer + capacity;
+    memset(decoded, 0, BITBENCH_RECORDS * sizeof(Bench_Record));
+    f64 write_seconds = 0.0;
+    f64 read_seconds = 0.0;
+    bool overflowed = false;
+    int size = 0;
+    for (int round = 0; round < BITBENCH_ROUNDS; ++round)
+    {
+        f64 start = get_seconds();
+        Bit_Writer writer = make_bit_writer(buffer, capacity);
+        for (int r = 0; r < BITBENCH_RECORDS; ++r)
+        {
+            schema->write(&writer, records + r);
+        }
+        f64 middle = get_seconds();
+        Bit_Reader reader = make_bit_reader(buffer, bit_writer_size(&writer));
+        for (int r = 0; r < BITBENCH_RECORDS; ++r)
+        {
+            schema->read(&reader, decoded + r);
+        }
+        f64 end = get_seconds();
+        write_seconds += middle - start;
+        read_seconds += end - middle;
+        overflowed |= writer.overflowed || reader.overflowed;
+        size = bit_writer_size(&writer);
+    }
+
+    // Quantized values only come back to within a step, but they pack the same.
+    Bit_Writer writer = make_bit_writer(repacked, capacity);
+    for (int r = 0; r < BITBENCH_RECORDS; ++r)
+    {
+        schema->write(&writer, decoded + r);
+    }
+    bool matched = !overflowed && !writer.overflowed && bit_writer_size(&writer) == size &&
+        memcmp(buffer, repacked, size) == 0;
+
+    f64 fields = (f64)BITBENCH_RECORDS * BITBENCH_ROUNDS * schema->field_count();
+    push_console_string("  %-9s write %5.2fns  read %5.2fns  %5.2f bits per field%s", schema->name,
+        write_seconds * 1e9 / fields, read_seconds * 1e9 / fields,
+        size * 8.0 / (BITBENCH_RECORDS * schema->field_count()), matched ? "" : "  MISMATCH");
+    return matched;
+}
+
+void measure_snapshot_sizes()
+{
+    if (snapshots_sent > 0)
+    {
+        push_console_string("  Snapshots sent: %.1f bytes on average, over %llu.",
+            (f64)snapshot_bytes_sent / snapshots_sent, (unsigned long long)snapshots_sent);
+    }
+
+    int viewers = 0;
+    int total_size = 0;
+    int largest = 0;
+    int failed = 0;
+    f64 seconds = 0.0;
+    u8 buffer[SNAPSHOT_MAX_SIZE];
+    for (int i = 0; i < player_count && viewers < BITBENCH_MAX_SNAPSHOTS; ++i)
+    {
+        if (!players.in_use[i]) continue;
+        Client * client = create_client(NULL, 0, i);
+        client->rate.budget = SNAPSHOT_MAX_SIZE;
+        client->has_input = true;
+        f64 start = get_seconds();
+        int size = write_snapshot(client, buffer, sizeof(buffer));
+        seconds += get_seconds() - start;
+        destroy_client(client);
+        if (size == 0) ++failed;
+        total_size += size;
+        largest = max(largest, size);
+        ++viewers;
+    }
+    if (viewers == 0) return;
+    push_console_string("  Full snapshots: %.1f bytes on average, %d at most, %.1fus each to write.",
+        (f32)total_size / viewers, largest, seconds * 1e6 / viewers);
+    if (failed) push_console_string("  %d snapshots overflowed and would have been dropped.", failed);
+}
+
+void bitbench_command()
+{
+    Bench_Record * records = calloc(BITBENCH_RECORDS, sizeof(Bench_Record));
+    Bench_Record * decoded = calloc(BITBENCH_RECORDS, sizeof(Bench_Record));
+    // Room for any one schema's records, twice over.
+    u8 * buffer = malloc(2 * (BITBENCH_RECORDS * sizeof(Bench_Record) + 8));
+    assert(records && decoded && buffer);
+
+    u64 seed[2] = { 0x6C616279, 0x72696E74 };
+    fill_bench_records(records, seed);
+
+    push_console_string("Packing and unpacking %d records of each kind:", BITBENCH_RECORDS * BITBENCH_ROUNDS);
+    int failures = 0;
+    for (int i = 0; i < (int)(sizeof(bench_schemas) / sizeof(bench_schemas[0])); ++i)
+    {
+        if (!time_schema(bench_schemas + i, records, decoded, buffer)) ++failures;
+    }
+    if (failures) push_console_string("  %d kinds did not read back what was written.", failures);
+
+    measure_snapshot_sizes();
+
+    free(records);
+    free(decoded);
+    free(buffer);
+}
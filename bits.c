@@ -0,0 +1,326 @@
+/*
+    Labyrinth
+    Benedict Henshaw, 2018
+    bits.c - Packing values into, and out of, streams of bits.
+*/
+
+// Values are packed least significant bit first. Neither the writer nor the
+// reader ever touches memory outside of its buffer: instead they set
+// overflowed, after which writes are dropped and reads return zero. Readers
+// also set it on values that no writer could have produced, such as a ranged
+// integer past the end of its range, so a malformed packet can only ever read
+// as a short one. Check it once at the end rather than after every value.
+//
+// Away from the end of the buffer, bits are moved eight bytes at a time, with
+// one load and one store, rather than a byte at a time. The writer may then
+// scribble on the bytes just past what it has written, but never past its
+// capacity, and they are overwritten by whatever is written next.
+//
+// On top of plain bits there are integers limited to a range, floats
+// quantized to a range, and varints for integers that are usually small.
+// Messages with fixed layouts are best described by a schema; see
+// DEFINE_SCHEMA at the end of this file. "/bitbench" times all of them.
+
+typedef struct
+{
+    u8 * data;
+    int capacity;
+    int bit_count;
+    bool overflowed;
+}
+Bit_Writer;
+
+typedef struct
+{
+    u8 * data;
+    int size;
+    int bit_position;
+    bool overflowed;
+}
+Bit_Reader;
+
+Bit_Writer make_bit_writer(void * data, int capacity)
+{
+    return (Bit_Writer){ .data = data, .capacity = capacity };
+}
+
+Bit_Reader make_bit_reader(void * data, int size)
+{
+    return (Bit_Reader){ .data = data, .size = size };
+}
+
+// Number of whole bytes needed to hold everything written so far.
+int bit_writer_size(Bit_Writer * writer)
+{
+    return (writer->bit_count + 7) / 8;
+}
+
+void write_bits(Bit_Writer * writer, u32 value, int bit_count)
+{
+    assert(bit_count >= 0 && bit_count <= 32);
+    if (writer->overflowed || writer->bit_count + bit_count > writer->capacity * 8)
+    {
+        writer->overflowed = true;
+        return;
+    }
+
+    int byte_index = writer->bit_count / 8;
+    int bit_offset = writer->bit_count % 8;
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+    if (byte_index + 8 <= writer->capacity)
+    {
+        u64 word;
+        memcpy(&word, writer->data + byte_index, sizeof(word));
+        word &= (1ull << bit_offset) - 1;
+        word |= (value & ((1ull << bit_count) - 1)) << bit_offset;
+        memcpy(writer->data + byte_index, &word, sizeof(word));
+        writer->bit_count += bit_count;
+        return;
+    }
+#endif
+
+    while (bit_count > 0)
+    {
+        byte_index = writer->bit_count / 8;
+        bit_offset = writer->bit_count % 8;
+        int chunk = min(8 - bit_offset, bit_count);
+        if (bit_offset == 0) writer->data[byte_index] = 0;
+        writer->data[byte_index] |= (value & ((1u << chunk) - 1)) << bit_offset;
+        value = chunk < 32 ? value >> chunk : 0;
+        bit_count -= chunk;
+        writer->bit_count += chunk;
+    }
+}
+
+u32 read_bits(Bit_Reader * reader, int bit_count)
+{
+    assert(bit_count >= 0 && bit_count <= 32);
+    if (reader->overflowed || reader->bit_position + bit_count > reader->size * 8)
+    {
+        reader->overflowed = true;
+        return 0;
+    }
+
+    int byte_index = reader->bit_position / 8;
+    int bit_offset = reader->bit_position % 8;
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+    if (byte_index + 8 <= reader->size)
+    {
+        u64 word;
+        memcpy(&word, reader->data + byte_index, sizeof(word));
+        reader->bit_position += bit_count;
+        return (word >> bit_offset) & ((1ull << bit_count) - 1);
+    }
+#endif
+
+    u32 value = 0;
+    int shift = 0;
+    while (bit_count > 0)
+    {
+        byte_index = reader->bit_position / 8;
+        bit_offset = reader->bit_position % 8;
+        int chunk = min(8 - bit_offset, bit_count);
+        u32 bits = (reader->data[byte_index] >> bit_offset) & ((1u << chunk) - 1);
+        value |= bits << shift;
+        shift += chunk;
+        bit_count -= chunk;
+        reader->bit_position += chunk;
+    }
+    return value;
+}
+
+void write_bool(Bit_Writer * writer, bool value)
+{
+    write_bits(writer, value, 1);
+}
+
+bool read_bool(Bit_Reader * reader)
+{
+    return read_bits(reader, 1);
+}
+
+// Number of bits needed to store every integer from 0 to count - 1.
+int bits_for_count(u32 count)
+{
+    // That is, the position of the highest bit set in count - 1.
+    return count > 1 ? 32 - __builtin_clz(count - 1) : 0;
+}
+
+// Map a value in [low, high] to an integer of the given number of bits.
+u32 quantize_f32(f32 value, f32 low, f32 high, int bit_count)
+{
+    u32 steps = (1ull << bit_count) - 1;
+    f32 t = (clamp(low, value, high) - low) / (high - low);
+    return (u32)(t * steps + 0.5f);
+}
+
+f32 dequantize_f32(u32 value, f32 low, f32 high, int bit_count)
+{
+    u32 steps = (1ull << bit_count) - 1;
+    return low + (value / (f32)steps) * (high - low);
+}
+
+void write_quantized(Bit_Writer * writer, f32 value, f32 low, f32 high, int bit_count)
+{
+    write_bits(writer, quantize_f32(value, low, high, bit_count), bit_count);
+}
+
+f32 read_quantized(Bit_Reader * reader, f32 low, f32 high, int bit_count)
+{
+    return dequantize_f32(read_bits(reader, bit_count), low, high, bit_count);
+}
+
+// Number of bits needed to store every integer from low to high.
+int ranged_bits(s32 low, s32 high)
+{
+    assert(low <= high && (u32)(high - low) < UINT32_MAX);
+    return bits_for_count((u32)(high - low) + 1);
+}
+
+// Integers in [low, high], stored as their offset from low. Values outside
+// the range are clamped to it.
+void write_ranged(Bit_Writer * writer, s32 value, s32 low, s32 high)
+{
+    write_bits(writer, (u32)(clamp(low, value, high) - low), ranged_bits(low, high));
+}
+
+s32 read_ranged(Bit_Reader * reader, s32 low, s32 high)
+{
+    u32 offset = read_bits(reader, ranged_bits(low, high));
+    if (offset > (u32)(high - low))
+    {
+        reader->overflowed = true;
+        return low;
+    }
+    return low + (s32)offset;
+}
+
+// Varints take eight bits for every seven bits of the value, lowest first,
+// with the top bit of each group set when another group follows. So values
+// below 128 take a byte, and the largest take five.
+#define VARINT_MAX_BITS 40
+
+void write_varint(Bit_Writer * writer, u32 value)
+{
+    while (value >= 0x80)
+    {
+        write_bits(writer, (value & 0x7F) | 0x80, 8);
+        value >>= 7;
+    }
+    write_bits(writer, value, 8);
+}
+
+u32 read_varint(Bit_Reader * reader)
+{
+    u32 value = 0;
+    for (int shift = 0; shift < 32; shift += 7)
+    {
+        u32 group = read_bits(reader, 8);
+        // Bits that a u32 has no room for mean the varint is malformed.
+        if (shift == 28 && group > 0x0F) break;
+        value |= (group & 0x7F) << shift;
+        if (!(group & 0x80)) return value;
+    }
+    reader->overflowed = true;
+    return 0;
+}
+
+// Signed values are zigzagged first, so that those near zero stay small:
+// 0, -1, 1, -2, 2 become 0, 1, 2, 3, 4.
+void write_signed_varint(Bit_Writer * writer, s32 value)
+{
+    write_varint(writer, ((u32)value << 1) ^ (u32)(value >> 31));
+}
+
+s32 read_signed_varint(Bit_Reader * reader)
+{
+    u32 value = read_varint(reader);
+    return (s32)(value >> 1) ^ -(s32)(value & 1);
+}
+
+// Floats that must survive exactly are sent as their raw bits.
+void write_f32(Bit_Writer * writer, f32 value)
+{
+    u32 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    write_bits(writer, bits, 32);
+}
+
+f32 read_f32(Bit_Reader * reader)
+{
+    u32 bits = read_bits(reader, 32);
+    f32 value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// A schema lists the fields of a struct in the order they are sent, and how
+// each is packed. DEFINE_SCHEMA turns one into a function that writes the
+// struct, one that reads it, and one that gives the most bits it can take.
+// As each field is named only once, the writer and the reader cannot drift
+// apart. A schema is a macro taking one macro for each kind of field, such
+// as this one from prediction.c (less the backslashes):
+//
+//   #define INPUT_SCHEMA(BITS, RANGED, QUANTIZED, VARINT, FLAG, EXACT)
+//       BITS(buttons, INPUT_BUTTON_BITS)
+//       QUANTIZED(angle, -PI, PI, INPUT_ANGLE_BITS)
+//
+//   DEFINE_SCHEMA(input, Player_Input, INPUT_SCHEMA)
+//
+// which defines write_input, read_input, input_bits and input_field_count.
+// The kinds are:
+//
+//   BITS(field, bit_count)                  an unsigned integer
+//   RANGED(field, low, high)                an integer in [low, high]
+//   QUANTIZED(field, low, high, bit_count)  a float in [low, high]
+//   VARINT(field)                           an unsigned integer, usually small
+//   FLAG(field)                             a bool
+//   EXACT(field)                            a float, sent as its raw bits
+//
+// Arguments are evaluated each time the struct is packed, so they need not
+// be constants: a position can use position_bits(), for instance.
+
+#define SCHEMA_WRITE_BITS(field, bit_count) write_bits(writer, value->field, bit_count);
+#define SCHEMA_WRITE_RANGED(field, low, high) write_ranged(writer, value->field, low, high);
+#define SCHEMA_WRITE_QUANTIZED(field, low, high, bit_count) write_quantized(writer, value->field, low, high, bit_count);
+#define SCHEMA_WRITE_VARINT(field) write_varint(writer, value->field);
+#define SCHEMA_WRITE_FLAG(field) write_bool(writer, value->field);
+#define SCHEMA_WRITE_EXACT(field) write_f32(writer, value->field);
+
+#define SCHEMA_READ_BITS(field, bit_count) value->field = read_bits(reader, bit_count);
+#define SCHEMA_READ_RANGED(field, low, high) value->field = read_ranged(reader, low, high);
+#define SCHEMA_READ_QUANTIZED(field, low, high, bit_count) value->field = read_quantized(reader, low, high, bit_count);
+#define SCHEMA_READ_VARINT(field) value->field = read_varint(reader);
+#define SCHEMA_READ_FLAG(field) value->field = read_bool(reader);
+#define SCHEMA_READ_EXACT(field) value->field = read_f32(reader);
+
+#define SCHEMA_SIZE_BITS(field, bit_count) + (bit_count)
+#define SCHEMA_SIZE_RANGED(field, low, high) + ranged_bits(low, high)
+#define SCHEMA_SIZE_QUANTIZED(field, low, high, bit_count) + (bit_count)
+#define SCHEMA_SIZE_VARINT(field) + VARINT_MAX_BITS
+#define SCHEMA_SIZE_FLAG(field) + 1
+#define SCHEMA_SIZE_EXACT(field) + 32
+
+#define SCHEMA_COUNT_FIELD(...) + 1
+
+#define DEFINE_SCHEMA(name, Type, SCHEMA) \
+    void write_##name(Bit_Writer * writer, Type * value) \
+    { \
+        SCHEMA(SCHEMA_WRITE_BITS, SCHEMA_WRITE_RANGED, SCHEMA_WRITE_QUANTIZED, \
+               SCHEMA_WRITE_VARINT, SCHEMA_WRITE_FLAG, SCHEMA_WRITE_EXACT) \
+    } \
+    void read_##name(Bit_Reader * reader, Type * value) \
+    { \
+        SCHEMA(SCHEMA_READ_BITS, SCHEMA_READ_RANGED, SCHEMA_READ_QUANTIZED, \
+               SCHEMA_READ_VARINT, SCHEMA_READ_FLAG, SCHEMA_READ_EXACT) \
+    } \
+    int name##_bits() \
+    { \
+        return 0 SCHEMA(SCHEMA_SIZE_BITS, SCHEMA_SIZE_RANGED, SCHEMA_SIZE_QUANTIZED, \
+                        SCHEMA_SIZE_VARINT, SCHEMA_SIZE_FLAG, SCHEMA_SIZE_EXACT); \
+    } \
+    int name##_field_count() \
+    { \
+        return 0 SCHEMA(SCHEMA_COUNT_FIELD, SCHEMA_COUNT_FIELD, SCHEMA_COUNT_FIELD, \
+                        SCHEMA_COUNT_FIELD, SCHEMA_COUNT_FIELD, SCHEMA_COUNT_FIELD); \
+    }
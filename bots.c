@@ -0,0 +1,271 @@
+/*
+    Labyrinth
+    Benedict Henshaw, 2018
+    bots.c - Computer controlled players that roam the labyrinth.
+*/
+
+// Bots find their way using flow fields: a breadth-first search outward from a
+// goal tile records, for every tile, which neighbouring tile is one step closer
+// to the goal. One field is shared by every bot heading to the same goal, so
+// the cost of path finding depends on the number of goals, not bots.
+//
+// Fields are built a little at a time. Each tick, at most FLOW_FIELD_BUDGET
+// tiles are expanded in total, shared between every field still being built,
+// so a burst of new goals can never stall a tick. Bots whose field is not yet
+// finished wait until it reaches them.
+
+#define MAX_FLOW_FIELDS 8
+#define MAX_BOT_GOALS 4
+#define FLOW_FIELD_BUDGET 512
+#define FLOW_UNREACHED 0xffff
+// Maximum change in a bot's angle per tick, in radians.
+#define BOT_TURN_SPEED 0.2f
+
+typedef struct
+{
+    // Tile index the field leads to, or -1 if the field is unused.
+    int goal;
+    // Number of steps from each tile to the goal, or FLOW_UNREACHED.
+    u16 * distance;
+    // Tile to step to from each tile to get closer to the goal.
+    int * next_tile;
+    // Breadth-first search queue, kept between ticks so building can resume.
+    int * frontier;
+    int frontier_start;
+    int frontier_end;
+    bool complete;
+    // Tick on which a bot last asked for this field, used to pick fields to reuse.
+    u64 last_used;
+}
+Flow_Field;
+
+typedef struct
+{
+    bool active;
+    int goal;
+    // Where the player is in bot_players, while active.
+    int list_index;
+}
+Bot;
+
+MATCH_LOCAL Flow_Field flow_fields[MAX_FLOW_FIELDS];
+MATCH_LOCAL Bot * bots;
+MATCH_LOCAL int bot_goals[MAX_BOT_GOALS];
+
+// Every player a bot is driving, in no particular order, so that one can be
+// handed over to a joining client without searching.
+MATCH_LOCAL int * bot_players;
+MATCH_LOCAL int bot_count;
+
+void resize_bots(int capacity)
+{
+    bots = resize_player_array(bots, sizeof(*bots), player_capacity, capacity);
+    bot_players = resize_player_array(bot_players, sizeof(*bot_players), player_capacity, capacity);
+}
+
+void init_bots()
+{
+    for (int i = 0; i < MAX_FLOW_FIELDS; ++i)
+    {
+        flow_fields[i].goal = -1;
+    }
+
+    // Pick a few open tiles for every bot to travel between. Keeping the set
+    // of goals small is what lets bots share flow fields.
+    for (int i = 0; i < MAX_BOT_GOALS; ++i)
+    {
+        int x, y;
+        do
+        {
+            x = random_int_range(0, map_width - 1);
+            y = random_int_range(0, map_height - 1);
+        }
+        while (map[x + y * map_width] != ' ');
+        bot_goals[i] = x + y * map_width;
+    }
+}
+
+// Start building a flow field from scratch toward the field's goal.
+void reset_flow_field(Flow_Field * field)
+{
+    int tile_count = map_width * map_height;
+    if (!field->distance)
+    {
+        field->distance  = malloc(tile_count * sizeof(*field->distance));
+        field->next_tile = malloc(tile_count * sizeof(*field->next_tile));
+        field->frontier  = malloc(tile_count * sizeof(*field->frontier));
+        assert(field->distance && field->next_tile && field->frontier);
+    }
+
+    for (int i = 0; i < tile_count; ++i)
+    {
+        field->distance[i] = FLOW_UNREACHED;
+        field->next_tile[i] = i;
+    }
+
+    field->distance[field->goal] = 0;
+    field->frontier[0] = field->goal;
+    field->frontier_start = 0;
+    field->frontier_end = 1;
+    field->complete = false;
+}
+
+// Rebuild every flow field, such as after the map has changed. The work is
+// spread over the following ticks like any other field.
+void invalidate_flow_fields()
+{
+    for (int i = 0; i < MAX_FLOW_FIELDS; ++i)
+    {
+        if (flow_fields[i].goal != -1) reset_flow_field(flow_fields + i);
+    }
+}
+
+// Find the field leading to a goal, or claim one to start building it.
+Flow_Field * get_flow_field(int goal)
+{
+    Flow_Field * oldest = flow_fields;
+    for (int i = 0; i < MAX_FLOW_FIELDS; ++i)
+    {
+        Flow_Field * field = flow_fields + i;
+        if (field->goal == goal)
+        {
+            field->last_used = tick_count;
+            return field;
+        }
+        if (field->goal == -1 || field->last_used < oldest->last_used)
+        {
+            oldest = field;
+        }
+    }
+
+    oldest->goal = goal;
+    oldest->last_used = tick_count;
+    reset_flow_field(oldest);
+    return oldest;
+}
+
+// Expand up to budget tiles of a field's search. Returns the unused budget.
+int expand_flow_field(Flow_Field * field, int budget)
+{
+    // Orthogonal steps come first so that they are preferred over diagonals.
+    static const int step_x[8] = { 1, -1, 0,  0, 1, -1,  1, -1 };
+    static const int step_y[8] = { 0,  0, 1, -1, 1,  1, -1, -1 };
+
+    while (budget > 0 && field->frontier_start < field->frontier_end)
+    {
+        int tile = field->frontier[field->frontier_start++];
+        int tile_x = tile % map_width;
+        int tile_y = tile / map_width;
+        --budget;
+
+        for (int i = 0; i < 8; ++i)
+        {
+            int x = tile_x + step_x[i];
+            int y = tile_y + step_y[i];
+            if (x < 0 || x >= map_width || y < 0 || y >= map_height) continue;
+
+            int neighbour = x + y * map_width;
+            if (map[neighbour] != ' ' || field->distance[neighbour] != FLOW_UNREACHED) continue;
+
+            // Only allow diagonal steps that do not clip the corner of a wall.
+            if (step_x[i] && step_y[i] &&
+                (map[x + tile_y * map_width] != ' ' || map[tile_x + y * map_width] != ' '))
+            {
+                continue;
+            }
+
+            field->distance[neighbour] = field->distance[tile] + 1;
+            field->next_tile[neighbour] = tile;
+            field->frontier[field->frontier_end++] = neighbour;
+        }
+    }
+
+    field->complete = field->frontier_start == field->frontier_end;
+    return budget;
+}
+
+// Spend this tick's budget on every field still being built, split evenly so
+// that they all progress together.
+void update_flow_fields()
+{
+    int budget = FLOW_FIELD_BUDGET;
+    int pending = 0;
+    for (int i = 0; i < MAX_FLOW_FIELDS; ++i)
+    {
+        if (flow_fields[i].goal != -1 && !flow_fields[i].complete) ++pending;
+    }
+
+    for (int i = 0; i < MAX_FLOW_FIELDS && pending > 0; ++i)
+    {
+        Flow_Field * field = flow_fields + i;
+        if (field->goal != -1 && !field->complete)
+        {
+            int share = budget / pending;
+            budget -= share - expand_flow_field(field, share);
+            --pending;
+        }
+    }
+}
+
+void add_bot(int player_index)
+{
+    Bot * bot = bots + player_index;
+    if (!bot->active)
+    {
+        bot->active = true;
+        bot->list_index = bot_count;
+        bot_players[bot_count++] = player_index;
+    }
+    bot->goal = bot_goals[random_int_range(0, MAX_BOT_GOALS - 1)];
+}
+
+void remove_bot(int player_index)
+{
+    Bot * bot = bots + player_index;
+    if (!bot->active) return;
+    bot->active = false;
+    // Fill the gap with the last bot in the list.
+    int last = bot_players[--bot_count];
+    bot_players[bot->list_index] = last;
+    bots[last].list_index = bot->list_index;
+}
+
+// Steer every bot one tick along the flow field toward its goal.
+void update_bots()
+{
+    update_flow_fields();
+
+    for (int i = 0; i < player_count; ++i)
+    {
+        Bot * bot = bots + i;
+        if (!bot->active) continue;
+
+        players.walk_acceleration[i] = 0.0f;
+        players.strafe_acceleration[i] = 0.0f;
+        if (!bots_enabled) continue;
+
+        int tile = (int)players.x[i] + (int)players.y[i] * map_width;
+        if (tile == bot->goal)
+        {
+            bot->goal = bot_goals[random_int_range(0, MAX_BOT_GOALS - 1)];
+        }
+
+        Flow_Field * field = get_flow_field(bot->goal);
+        if (field->distance[tile] == FLOW_UNREACHED) continue;
+
+        // Head for the centre of the next tile along the field.
+        int next = field->next_tile[tile];
+        f32 target_x = (next % map_width) + 0.5f;
+        f32 target_y = (next / map_width) + 0.5f;
+        f32 turn = atan2f(target_y - players.y[i], target_x - players.x[i]) - players.angle[i];
+        turn -= turn >  PI ? TWO_PI : 0.0f;
+        turn += turn < -PI ? TWO_PI : 0.0f;
+        set_player_angle(i, players.angle[i] + clamp(-BOT_TURN_SPEED, turn, BOT_TURN_SPEED));
+
+        // Slow down for sharp turns so that bots do not scrape along walls.
+        if (fabsf(turn) < HALF_PI)
+        {
+            players.walk_acceleration[i] = players.speed[i] * TICK_DURATION;
+        }
+    }
+}
@@ -0,0 +1,306 @@
+/*
+    Labyrinth
+    Benedict Henshaw, 2018
+    combat.c - Deciding, on the server, who shot whom.
+*/
+
+// Only the server decides what a shot hits. A client that fires sends a fire
+// intent: the input it fired on, the angle it fired at, and how far behind the
+// server its view of the other players was. The server checks each intent as
+// it arrives and queues those that pass. Once a tick, before anyone moves, it
+// resolves up to COMBAT_BATCH_SIZE of them in the order they arrived, and any
+// more wait for the next tick. So however many players fire at once, a tick
+// only ever spends so long on shots.
+//
+// An intent is turned away if it is for an input no newer than the client's
+// last shot, or fewer than COMBAT_FIRE_INTERVAL inputs after it, or far ahead
+// of any input the client has sent. Those hold the client to the rate of fire
+// by its own clock. So that sending inputs faster gains nothing, each client
+// also has an allowance of shots, which refills by one every
+// COMBAT_FIRE_INTERVAL ticks of the server's clock, up to COMBAT_BURST.
+//
+// Each shot is judged against the world as its shooter saw it; see rewind.c.
+// A batch is sorted by the time each shot was aimed at, and shots aimed
+// within 1/COMBAT_REWIND_STEPS of a tick of each other share one rewind.
+// Shots are resolved in that order, so a player killed by an earlier shot in
+// the batch neither fires nor is hit afterwards. The host's own shots, on a
+// server or offline, go through the same queue, aimed at the current tick.
+//
+// Every kill is sent to every client on the reliable channel, along with
+// where the victim respawned. A client that was the victim moves its player
+// there at once, rather than a round trip later when the snapshot arrives,
+// and ignores any snapshot from before its death that arrives after.
+//
+// Fire intent:
+//   u8 MESSAGE_SHOOT
+//   16 bits input sequence, ANGLE_BITS angle,
+//   16 bits interpolation delay in milliseconds
+//
+// Kill:
+//   u8 MESSAGE_KILL
+//   16 bits server tick, shooter and victim below PLAYER_LIMIT,
+//   16 bits the victim's last applied input, respawn x and y as f32,
+//   ANGLE_BITS respawn angle
+
+#define COMBAT_FIRE_INTERVAL (TICK_RATE / 4)
+#define COMBAT_BURST 2
+// Inputs a shot may be ahead of the newest input the server has received,
+// as the two travel on different channels.
+#define COMBAT_INPUT_SLACK 30
+#define COMBAT_QUEUE_CAPACITY 256
+#define COMBAT_BATCH_SIZE 32
+#define COMBAT_REWIND_STEPS 4
+
+typedef struct
+{
+    u16 input;
+    f32 angle;
+    u32 delay;
+}
+Shot_Intent;
+
+#define SHOT_INTENT_SCHEMA(BITS, RANGED, QUANTIZED, VARINT, FLAG, EXACT) \
+    BITS(input, 16) QUANTIZED(angle, -PI, PI, ANGLE_BITS) BITS(delay, 16)
+
+DEFINE_SCHEMA(shot_intent, Shot_Intent, SHOT_INTENT_SCHEMA)
+
+typedef struct
+{
+    u16 tick;
+    s32 shooter;
+    s32 victim;
+    u16 victim_input;
+    f32 x;
+    f32 y;
+    f32 angle;
+}
+Kill_Event;
+
+#define KILL_EVENT_SCHEMA(BITS, RANGED, QUANTIZED, VARINT, FLAG, EXACT) \
+    BITS(tick, 16) RANGED(shooter, 0, PLAYER_LIMIT - 1) RANGED(victim, 0, PLAYER_LIMIT - 1) \
+    BITS(victim_input, 16) EXACT(x) EXACT(y) QUANTIZED(angle, -PI, PI, ANGLE_BITS)
+
+DEFINE_SCHEMA(kill_event, Kill_Event, KILL_EVENT_SCHEMA)
+
+typedef struct
+{
+    int shooter;
+    f32 angle;
+    // The server tick the shot was aimed at, which may fall between two.
+    f64 aim_tick;
+}
+Pending_Shot;
+
+typedef struct
+{
+    u64 received;
+    u64 rejected;
+    u64 resolved;
+    u64 kills;
+    // Shots left waiting at the end of a tick, summed over every tick.
+    u64 deferred;
+    int largest_batch;
+}
+Combat_Stats;
+
+// Shots waiting to be resolved, oldest first.
+MATCH_LOCAL Pending_Shot shot_queue[COMBAT_QUEUE_CAPACITY];
+MATCH_LOCAL int shot_queue_start;
+MATCH_LOCAL int shot_queue_count;
+MATCH_LOCAL Combat_Stats combat_stats;
+
+bool queue_shot(int shooter, f32 angle, f64 aim_tick)
+{
+    if (shot_queue_count == COMBAT_QUEUE_CAPACITY) return false;
+    int slot = (shot_queue_start + shot_queue_count++) % COMBAT_QUEUE_CAPACITY;
+    shot_queue[slot] = (Pending_Shot){ .shooter = shooter, .angle = angle, .aim_tick = aim_tick };
+    return true;
+}
+
+void queue_local_shot(f32 angle)
+{
+    queue_shot(local_player, angle, tick_count);
+}
+
+int write_shot(u8 * buffer, int capacity, Shot_Intent * intent)
+{
+    buffer[0] = MESSAGE_SHOOT;
+    Bit_Writer writer = make_bit_writer(buffer + 1, capacity - 1);
+    write_shot_intent(&writer, intent);
+    return writer.overflowed ? 0 : 1 + bit_writer_size(&writer);
+}
+
+// Whether a client may fire the shot it asked to. Spends from its allowance if so.
+bool accept_shot(Client * client, Shot_Intent * intent)
+{
+    Fire_Limit * fire = &client->fire;
+    if (fire->has_fired && (!sequence_newer(intent->input, fire->last_input) ||
+                            (u16)(intent->input - fire->last_input) < COMBAT_FIRE_INTERVAL))
+    {
+        return false;
+    }
+    if (client->has_input && sequence_newer(intent->input, client->newest_input + COMBAT_INPUT_SLACK)) return false;
+
+    f32 refill = (tick_count - fire->refilled_tick) / (f32)COMBAT_FIRE_INTERVAL;
+    fire->allowance = min(fire->allowance + refill, COMBAT_BURST);
+    fire->refilled_tick = tick_count;
+    if (fire->allowance < 1.0f) return false;
+
+    fire->allowance -= 1.0f;
+    fire->last_input = intent->input;
+    fire->has_fired = true;
+    return true;
+}
+
+// A fire intent from a client, to be resolved on the next tick if it passes.
+void read_shot(Client * client, u8 * data, int size)
+{
+    Bit_Reader reader = make_bit_reader(data + 1, size - 1);
+    Shot_Intent intent;
+    read_shot_intent(&reader, &intent);
+    if (reader.overflowed) return;
+
+    ++combat_stats.received;
+    // ENet's figure is only read for this; at worst it is a moment out of date.
+    f64 round_trip = client->peer->roundTripTime / 1000.0;
+    f64 seconds = min(round_trip + intent.delay / 1000.0, MAX_REWIND);
+    if (!accept_shot(client, &intent) ||
+        !queue_shot(client->player_index, intent.angle, tick_count - seconds * TICK_RATE))
+    {
+        ++combat_stats.rejected;
+    }
+}
+
+void print_kill(Kill_Event * kill)
+{
+    if (kill->victim == local_player)       push_console_string("Player %d shot you.", kill->shooter);
+    else if (kill->shooter == local_player) push_console_string("You shot player %d.", kill->victim);
+    else                                    push_console_string("Player %d shot player %d.", kill->shooter, kill->victim);
+}
+
+// Respawn the victim of a kill, and tell every client about both.
+void announce_kill(Kill_Event * kill)
+{
+    randomly_spawn_player(kill->victim);
+    kill->tick = tick_count;
+    kill->x = players.x[kill->victim];
+    kill->y = players.y[kill->victim];
+    kill->angle = players.angle[kill->victim];
+    for (int i = 0; i < client_count; ++i)
+    {
+        if (clients[i]->player_index == kill->victim) kill->victim_input = clients[i]->applied_input;
+    }
+    ++combat_stats.kills;
+
+    u8 message[32];
+    message[0] = MESSAGE_KILL;
+    Bit_Writer writer = make_bit_writer(message + 1, sizeof(message) - 1);
+    write_kill_event(&writer, kill);
+    for (int i = 0; i < client_count; ++i)
+    {
+        queue_message(&clients[i]->outbox, CHANNEL_RELIABLE, message, 1 + bit_writer_size(&writer));
+    }
+    // A busy dedicated server would have little else in its output.
+    if (!headless) print_kill(kill);
+}
+
+// A kill from the server.
+void read_kill(u8 * data, int size)
+{
+    Bit_Reader reader = make_bit_reader(data + 1, size - 1);
+    Kill_Event kill;
+    read_kill_event(&reader, &kill);
+    if (reader.overflowed || !position_in_map(kill.x, kill.y)) return;
+    print_kill(&kill);
+
+    if (kill.victim == local_player)
+    {
+        players.x[local_player] = kill.x;
+        players.y[local_player] = kill.y;
+        set_player_angle(local_player, kill.angle);
+        prediction_error_x = prediction_error_y = 0.0f;
+        respawn_input = kill.victim_input;
+        has_respawn_input = true;
+    }
+}
+
+int compare_aim_ticks(const void * a, const void * b)
+{
+    f64 x = ((const Pending_Shot *)a)->aim_tick;
+    f64 y = ((const Pending_Shot *)b)->aim_tick;
+    return (x > y) - (x < y);
+}
+
+f64 rewind_step(Pending_Shot * shot)
+{
+    return floor(shot->aim_tick * COMBAT_REWIND_STEPS + 0.5) / COMBAT_REWIND_STEPS;
+}
+
+// Called by the server, or offline, at the start of every tick.
+void resolve_shots()
+{
+    if (network_mode == NETMODE_CLIENT || shot_queue_count == 0) return;
+
+    Pending_Shot batch[COMBAT_BATCH_SIZE];
+    int count = min(shot_queue_count, COMBAT_BATCH_SIZE);
+    for (int i = 0; i < count; ++i)
+    {
+        batch[i] = shot_queue[(shot_queue_start + i) % COMBAT_QUEUE_CAPACITY];
+    }
+    shot_queue_start = (shot_queue_start + count) % COMBAT_QUEUE_CAPACITY;
+    shot_queue_count -= count;
+    combat_stats.resolved += count;
+    combat_stats.deferred += shot_queue_count;
+    combat_stats.largest_batch = max(combat_stats.largest_batch, count);
+    qsort(batch, count, sizeof(Pending_Shot), compare_aim_ticks);
+
+    Kill_Event kills[COMBAT_BATCH_SIZE];
+    int kill_count = 0;
+    for (int first = 0; first < count;)
+    {
+        f64 step = rewind_step(batch + first);
+        int end = first;
+        while (end < count && rewind_step(batch + end) == step) ++end;
+
+        rewind_players(-1, step);
+        for (int i = first; i < end; ++i)
+        {
+            int shooter = batch[i].shooter;
+            if (shooter >= player_count || !players.in_use[shooter] || players.hidden[shooter]) continue;
+
+            // Shots are fired from where the shooter is now.
+            f32 rewound_x = players.x[shooter];
+            f32 rewound_y = players.y[shooter];
+            players.x[shooter] = unwound_x[shooter];
+            players.y[shooter] = unwound_y[shooter];
+            int victim = hitscan(shooter, batch[i].angle);
+            players.x[shooter] = rewound_x;
+            players.y[shooter] = rewound_y;
+
+            if (victim != -1)
+            {
+                // Out of the fight for the rest of the batch.
+                players.hidden[victim] = true;
+                kills[kill_count++] = (Kill_Event){ .shooter = shooter, .victim = victim };
+            }
+        }
+        restore_players();
+        first = end;
+    }
+
+    for (int i = 0; i < kill_count; ++i)
+    {
+        players.hidden[kills[i].victim] = false;
+        announce_kill(kills + i);
+    }
+}
+
+void combat_command()
+{
+    Combat_Stats * stats = &combat_stats;
+    push_console_string("Shots: %llu received, %llu turned away, %llu resolved, %llu kills.",
+        (unsigned long long)stats->received, (unsigned long long)stats->rejected,
+        (unsigned long long)stats->resolved, (unsigned long long)stats->kills);
+    push_console_string("  Largest batch %d of %d, %llu shot-ticks spent waiting, %d waiting now.",
+        stats->largest_batch, COMBAT_BATCH_SIZE, (unsigned long long)stats->deferred, shot_queue_count);
+}
@@ -18,26 +18,36 @@ f32 dist2(f32 ax, f32 ay, f32 bx, f32 by)
     return sqrtf((ax - bx) * (ax - bx) + (ay - by) * (ay - by));
 }
 
-u64 random_seed[2] = { (u64)__DATE__, (u64)__TIME__ };
+MATCH_LOCAL u64 random_seed[2] = { (u64)__DATE__, (u64)__TIME__ };
 
-u64 random_u64()
+// Purely visual effects draw from their own generator so that how often a
+// frame is drawn can never change the numbers the simulation receives.
+u64 noise_seed[2] = { (u64)__TIME__, (u64)__DATE__ };
+
+// Get the next random number from the given generator state.
+u64 random_u64_from(u64 * seed)
 {
     // Get the next random number.
-    u64 s0 = random_seed[0];
-    u64 s1 = random_seed[1];
+    u64 s0 = seed[0];
+    u64 s1 = seed[1];
     u64 result = s0 + s1;
 
     // Increment the generator.
     s1 ^= s0;
     #define LS(x, k) ((x << k) | (x >> (64 - k)))
-    random_seed[0] = LS(s0, 55) ^ s1 ^ (s1 << 14);
-    random_seed[1] = LS(s1, 36);
+    seed[0] = LS(s0, 55) ^ s1 ^ (s1 << 14);
+    seed[1] = LS(s1, 36);
     #undef LS
 
     // Return the number.
     return result;
 }
 
+u64 random_u64()
+{
+    return random_u64_from(random_seed);
+}
+
 // Set the seed for the pseudo-random number generator.
 void set_seed(u64 a, u64 b)
 {
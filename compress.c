@@ -0,0 +1,444 @@
+/*
+    Labyrinth
+    Benedict Henshaw, 2018
+    compress.c - Compressing packets on their way in and out of ENet.
+*/
+
+// Packets are compressed one at a time by a binary range coder, as they may
+// arrive in any order or not at all. Each byte is coded a bit at a time down a
+// binary tree of probabilities, with a separate tree for each of the first
+// COMPRESS_CONTEXTS byte positions, since that is where ENet's command headers
+// and our message headers sit.
+//
+// A single packet is far too short for a model to learn much from, so every
+// packet starts from probabilities learned from real traffic, which live in
+// compress_model.h, and adapts from there. "/compress train" starts counting
+// the bytes of every packet sent, and of every compressed packet received, and
+// "/compress save" writes out a new model from those counts. Both ends must
+// use the same model.
+//
+//   13 bits original length, then the coded bytes
+//
+// The coder is installed on every host, so that either end can always read
+// what the other sends. compression_enabled only decides whether to compress
+// outgoing packets, and ENet sends a packet as it is whenever compressing it
+// would not make it smaller.
+
+#define PROBABILITY_BITS 11
+#define PROBABILITY_ONE (1 << PROBABILITY_BITS)
+#define ADAPTATION_SHIFT 5
+#define RANGE_TOP (1u << 24)
+#define COMPRESS_CONTEXTS 32
+#define COMPRESS_LENGTH_BITS 13
+
+#include "compress_model.h"
+
+typedef struct
+{
+    u16 probabilities[COMPRESS_CONTEXTS][256];
+}
+Byte_Model;
+
+typedef struct
+{
+    u64 low;
+    u32 range;
+    u8 cache;
+    int cache_size;
+    bool started;
+    u8 * data;
+    int size;
+    int capacity;
+    bool overflowed;
+}
+Range_Encoder;
+
+typedef struct
+{
+    u32 code;
+    u32 range;
+    const u8 * data;
+    int size;
+    int position;
+}
+Range_Decoder;
+
+// Running totals for each direction. Every host shares them, and hosts are
+// serviced by several threads at once (each match's, and the swarm's), so
+// they are only ever added to atomically. They are only read for display.
+typedef struct
+{
+    _Atomic u64 packet_count;
+    _Atomic u64 original_bytes;
+    _Atomic u64 compressed_bytes;
+    _Atomic u64 counter_ticks;
+}
+Compression_Stats;
+
+Compression_Stats compress_stats;
+Compression_Stats decompress_stats;
+SDL_atomic_t compression_enabled = { 1 };
+
+// The model every packet starts from, unpacked from compress_model.h.
+Byte_Model initial_model;
+
+// How many times each bit was zero and one, at each node of each tree, while
+// training. Like the stats, written by every thread that services a host.
+_Atomic u32 training_counts[COMPRESS_CONTEXTS][256][2];
+SDL_atomic_t compression_training;
+
+// Each hex digit in the model is a chance of zero, in sixteenths, centred in
+// its sixteenth so that no bit is ever certain.
+void load_compression_model()
+{
+    for (int c = 0; c < COMPRESS_CONTEXTS; ++c)
+    {
+        for (int i = 0; i < 256; ++i)
+        {
+            char digit = compress_model[c][i];
+            int level = digit <= '9' ? digit - '0' : digit - 'a' + 10;
+            initial_model.probabilities[c][i] = (2 * level + 1) * PROBABILITY_ONE / 32;
+        }
+    }
+}
+
+// A packet only ever touches the trees for the positions it has bytes at, so
+// only those are copied into the model that it adapts as it goes.
+void copy_initial_model(Byte_Model * model, size_t size)
+{
+    size_t contexts = min(size, (size_t)COMPRESS_CONTEXTS);
+    memcpy(model->probabilities, initial_model.probabilities, contexts * sizeof(model->probabilities[0]));
+}
+
+// Counters are only totals, so nothing needs ordering around them.
+void add_to_stat(_Atomic u64 * stat, u64 value)
+{
+    atomic_fetch_add_explicit(stat, value, memory_order_relaxed);
+}
+
+void add_compression_stats(Compression_Stats * stats, u64 original_bytes, u64 compressed_bytes, u64 start)
+{
+    add_to_stat(&stats->packet_count, 1);
+    add_to_stat(&stats->original_bytes, original_bytes);
+    add_to_stat(&stats->compressed_bytes, compressed_bytes);
+    add_to_stat(&stats->counter_ticks, SDL_GetPerformanceCounter() - start);
+}
+
+void count_training_byte(int position, u8 byte)
+{
+    _Atomic u32 (*counts)[2] = training_counts[min(position, COMPRESS_CONTEXTS - 1)];
+    int node = 1;
+    for (int bit = 7; bit >= 0; --bit)
+    {
+        int value = (byte >> bit) & 1;
+        atomic_fetch_add_explicit(&counts[node][value], 1, memory_order_relaxed);
+        node = node * 2 + value;
+    }
+}
+
+void emit_range_byte(Range_Encoder * encoder, u8 byte)
+{
+    // The very first byte out of the coder is always zero, so it is not sent.
+    if (!encoder->started)
+    {
+        encoder->started = true;
+        return;
+    }
+    if (encoder->size >= encoder->capacity)
+    {
+        encoder->overflowed = true;
+        return;
+    }
+    encoder->data[encoder->size++] = byte;
+}
+
+// Move the top byte of low out, holding back runs of 0xFF until it is known
+// whether a carry will ripple through them.
+void shift_range_low(Range_Encoder * encoder)
+{
+    if ((u32)encoder->low < 0xFF000000u || (encoder->low >> 32) != 0)
+    {
+        u8 carry = encoder->low >> 32;
+        u8 byte = encoder->cache;
+        do
+        {
+            emit_range_byte(encoder, byte + carry);
+            byte = 0xFF;
+        }
+        while (--encoder->cache_size != 0);
+        encoder->cache = encoder->low >> 24;
+    }
+    ++encoder->cache_size;
+    encoder->low = (encoder->low & 0x00FFFFFF) << 8;
+}
+
+void encode_bit(Range_Encoder * encoder, u16 * probability, int bit)
+{
+    u32 bound = (encoder->range >> PROBABILITY_BITS) * *probability;
+    if (bit)
+    {
+        encoder->low += bound;
+        encoder->range -= bound;
+        *probability -= *probability >> ADAPTATION_SHIFT;
+    }
+    else
+    {
+        encoder->range = bound;
+        *probability += (PROBABILITY_ONE - *probability) >> ADAPTATION_SHIFT;
+    }
+    while (encoder->range < RANGE_TOP)
+    {
+        encoder->range <<= 8;
+        shift_range_low(encoder);
+    }
+}
+
+void encode_direct_bits(Range_Encoder * encoder, u32 value, int bit_count)
+{
+    while (bit_count--)
+    {
+        encoder->range >>= 1;
+        if ((value >> bit_count) & 1) encoder->low += encoder->range;
+        while (encoder->range < RANGE_TOP)
+        {
+            encoder->range <<= 8;
+            shift_range_low(encoder);
+        }
+    }
+}
+
+// Settle on the value in the final range with the most trailing zero bits,
+// then drop the zero bytes from the end: the decoder reads zeros past the end
+// of its input anyway.
+void finish_range_encoder(Range_Encoder * encoder)
+{
+    u64 end = encoder->low + encoder->range;
+    for (int bits = 32; bits > 0; --bits)
+    {
+        u64 mask = (1ull << bits) - 1;
+        u64 value = (encoder->low + mask) & ~mask;
+        if (value < end)
+        {
+            encoder->low = value;
+            break;
+        }
+    }
+    for (int i = 0; i < 5; ++i)
+    {
+        shift_range_low(encoder);
+    }
+    while (encoder->size > 0 && encoder->data[encoder->size - 1] == 0)
+    {
+        --encoder->size;
+    }
+}
+
+u8 next_range_byte(Range_Decoder * decoder)
+{
+    return decoder->position < decoder->size ? decoder->data[decoder->position++] : 0;
+}
+
+int decode_bit(Range_Decoder * decoder, u16 * probability)
+{
+    u32 bound = (decoder->range >> PROBABILITY_BITS) * *probability;
+    int bit;
+    if (decoder->code < bound)
+    {
+        decoder->range = bound;
+        *probability += (PROBABILITY_ONE - *probability) >> ADAPTATION_SHIFT;
+        bit = 0;
+    }
+    else
+    {
+        decoder->code -= bound;
+        decoder->range -= bound;
+        *probability -= *probability >> ADAPTATION_SHIFT;
+        bit = 1;
+    }
+    while (decoder->range < RANGE_TOP)
+    {
+        decoder->range <<= 8;
+        decoder->code = (decoder->code << 8) | next_range_byte(decoder);
+    }
+    return bit;
+}
+
+u32 decode_direct_bits(Range_Decoder * decoder, int bit_count)
+{
+    u32 value = 0;
+    while (bit_count--)
+    {
+        decoder->range >>= 1;
+        int bit = decoder->code >= decoder->range;
+        if (bit) decoder->code -= decoder->range;
+        value = (value << 1) | bit;
+        while (decoder->range < RANGE_TOP)
+        {
+            decoder->range <<= 8;
+            decoder->code = (decoder->code << 8) | next_range_byte(decoder);
+        }
+    }
+    return value;
+}
+
+size_t ENET_CALLBACK compress_packet(void * context, const ENetBuffer * buffers, size_t buffer_count,
+    size_t input_size, enet_uint8 * output, size_t output_capacity)
+{
+    if (SDL_AtomicGet(&compression_training))
+    {
+        int position = 0;
+        for (size_t b = 0; b < buffer_count; ++b)
+        {
+            for (size_t i = 0; i < buffers[b].dataLength; ++i)
+            {
+                count_training_byte(position++, ((u8 *)buffers[b].data)[i]);
+            }
+        }
+    }
+
+    if (!SDL_AtomicGet(&compression_enabled) || input_size >= (1 << COMPRESS_LENGTH_BITS)) return 0;
+    u64 start = SDL_GetPerformanceCounter();
+
+    Byte_Model model;
+    copy_initial_model(&model, input_size);
+    Range_Encoder encoder = {
+        .range = 0xFFFFFFFF, .cache_size = 1,
+        .data = output, .capacity = output_capacity,
+    };
+    encode_direct_bits(&encoder, input_size, COMPRESS_LENGTH_BITS);
+
+    int position = 0;
+    for (size_t b = 0; b < buffer_count; ++b)
+    {
+        const u8 * data = buffers[b].data;
+        for (size_t i = 0; i < buffers[b].dataLength && !encoder.overflowed; ++i, ++position)
+        {
+            u16 * probabilities = model.probabilities[min(position, COMPRESS_CONTEXTS - 1)];
+            int node = 1;
+            for (int bit = 7; bit >= 0; --bit)
+            {
+                int value = (data[i] >> bit) & 1;
+                encode_bit(&encoder, probabilities + node, value);
+                node = node * 2 + value;
+            }
+        }
+    }
+    finish_range_encoder(&encoder);
+
+    add_compression_stats(&compress_stats, input_size,
+        encoder.overflowed ? input_size : min((size_t)encoder.size, input_size), start);
+    return encoder.overflowed ? 0 : encoder.size;
+}
+
+size_t ENET_CALLBACK decompress_packet(void * context, const enet_uint8 * input, size_t input_size,
+    enet_uint8 * output, size_t output_capacity)
+{
+    u64 start = SDL_GetPerformanceCounter();
+
+    Range_Decoder decoder = { .range = 0xFFFFFFFF, .data = input, .size = input_size };
+    for (int i = 0; i < 4; ++i)
+    {
+        decoder.code = (decoder.code << 8) | next_range_byte(&decoder);
+    }
+    size_t output_size = decode_direct_bits(&decoder, COMPRESS_LENGTH_BITS);
+    if (output_size > output_capacity) return 0;
+
+    Byte_Model model;
+    copy_initial_model(&model, output_size);
+    bool training = SDL_AtomicGet(&compression_training);
+    for (size_t i = 0; i < output_size; ++i)
+    {
+        u16 * probabilities = model.probabilities[min(i, COMPRESS_CONTEXTS - 1)];
+        int node = 1;
+        while (node < 256)
+        {
+            node = node * 2 + decode_bit(&decoder, probabilities + node);
+        }
+        output[i] = node - 256;
+        if (training) count_training_byte(i, output[i]);
+    }
+
+    add_compression_stats(&decompress_stats, output_size, input_size, start);
+    return output_size;
+}
+
+void install_compressor(ENetHost * host)
+{
+    static bool model_loaded = false;
+    if (!model_loaded)
+    {
+        load_compression_model();
+        model_loaded = true;
+    }
+
+    ENetCompressor compressor = {
+        // ENet requires a context, though the coder keeps no state in it.
+        .context = &compress_stats,
+        .compress = compress_packet,
+        .decompress = decompress_packet,
+    };
+    enet_host_compress(host, &compressor);
+}
+
+void print_compression_stats(char * name, Compression_Stats * stats)
+{
+    u64 packet_count = atomic_load_explicit(&stats->packet_count, memory_order_relaxed);
+    u64 original_bytes = atomic_load_explicit(&stats->original_bytes, memory_order_relaxed);
+    u64 compressed_bytes = atomic_load_explicit(&stats->compressed_bytes, memory_order_relaxed);
+    u64 counter_ticks = atomic_load_explicit(&stats->counter_ticks, memory_order_relaxed);
+    if (packet_count == 0)
+    {
+        push_console_string("%s: no packets.", name);
+        return;
+    }
+    f64 microseconds = counter_ticks * 1000000.0 / SDL_GetPerformanceFrequency();
+    push_console_string("%s: %llu packets, %llu -> %llu bytes (%.1f%%), %.2fus per packet.", name,
+        (unsigned long long)packet_count,
+        (unsigned long long)original_bytes,
+        (unsigned long long)compressed_bytes,
+        100.0 * compressed_bytes / original_bytes,
+        microseconds / packet_count);
+}
+
+// Write the model learned from training as a replacement compress_model.h.
+void save_compression_model(char * file_name)
+{
+    FILE * file = fopen(file_name, "w");
+    if (!file)
+    {
+        push_console_string("Could not create '%s'.", file_name);
+        return;
+    }
+    fprintf(file, "// Generated by \"/compress save\" from the traffic of a play session.\n");
+    fprintf(file, "// One row per byte position, one hex digit per node of the bit tree.\n");
+    fprintf(file, "const char * compress_model[COMPRESS_CONTEXTS] =\n{\n");
+    for (int c = 0; c < COMPRESS_CONTEXTS; ++c)
+    {
+        fprintf(file, "    \"");
+        for (int i = 0; i < 256; ++i)
+        {
+            // Nodes that were never reached are left at even odds.
+            u32 zeros = atomic_load_explicit(&training_counts[c][i][0], memory_order_relaxed);
+            u32 total = zeros + atomic_load_explicit(&training_counts[c][i][1], memory_order_relaxed);
+            int level = total ? (int)((zeros + 0.4) / (total + 0.8) * 16) : 8;
+            fprintf(file, "%x", clamp(0, level, 15));
+        }
+        fprintf(file, "\",\n");
+    }
+    fprintf(file, "};\n");
+    fclose(file);
+    push_console_string("Saved compression model to '%s'.", file_name);
+}
+
+// Console command: "/compress" followed by on, off, train or save, or nothing
+// to show the stats.
+void compress_command(char * argument)
+{
+    if (argument && strcmp(argument, "on") == 0)         SDL_AtomicSet(&compression_enabled, 1);
+    else if (argument && strcmp(argument, "off") == 0)   SDL_AtomicSet(&compression_enabled, 0);
+    else if (argument && strcmp(argument, "train") == 0) SDL_AtomicSet(&compression_training, 1);
+    else if (argument && strcmp(argument, "save") == 0)  save_compression_model("compress_model.h");
+    push_console_string("Compression %s.", SDL_AtomicGet(&compression_enabled) ? "on" : "off");
+    print_compression_stats("Sent", &compress_stats);
+    print_compression_stats("Received", &decompress_stats);
+}
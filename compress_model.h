@@ -0,0 +1,37 @@
+// Generated by "/compress save" from the traffic of a play session.
+// One row per byte position, one hex digit per node of the bit tree.
+const char * compress_model[COMPRESS_CONTEXTS] =
+{
+    "8ffff8f8f888f888f8888888f888888808888888888888880888888888888888f08888888888888888888888888888881f88888888888888888888888888888808808888888888888888888888888888888888888888888888888888888888888a0c888888888888888888888888888888888888888888888888888888888888",
+    "8ef0f880f8888880f888888888888880f8888888888888888888888888888880f88888888888888888888888888888888888888888888888888888888888888008888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888880",
+    "8ff8f888f8888888f888888888888888f8888888888888888888888888888888f888888888888888888888888888888888888888888888888888888888888888f8888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888",
+    "8ff8f888ff888888f8c8888888888888f8888f88888888888888888888888888f888888888f88888888888888888888888888888888888888888888888888888f8888888888888888888688888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888",
+    "8ff8f888f8888888f888888888888888e8888888888888888888888888888888af8888888888888888888888888888888888888888888888888888888888888889f18888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888",
+    "8888888888888878888888888888878888888888888888888888888877888888888888888888888888888888888888888888888888888888887888888888888868888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888788888888888888888888",
+    "8ff2ff82f7f88882f888988888888882f88888788a8888888888888888888882f888888888888988888d88888888888888888888888888888888888888888882f22228888888888888888ddddda88888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888882",
+    "8ff8f677bc87886800ad889869a58a55d9cfc3e2888858a58a5d82d82d82d828f330380ce8b6f38d33c33cc3c83c83c83c83c828828828828828d28d28d28d82b88c00df8c88d083a8c45c95288c88888c83388c8338388338338c38338c38c38c38cc8cc8cc8888cc8888cc8888cc8888cc8888888888888888888888883382",
+    "8ff8f888f8888888f888888888888888f88888888888888888888888888888880c88888888888888888888888888888888888888888888888888888888888888b5c88888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888",
+    "8888888888888888887888888888888888888888778888888888888888888888888888888888888887788888888888888888888888888888888887888888888853333333333333333333333333333333333333333333333333333333333322222222222222222222222222222222222222222222222322222222222222222222",
+    "8ff8f888f8888888f888888888888888e88888888888888888888888888888889f8888888888888888888888888888888888888888888888888888888888888889f88888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888",
+    "88787778788788888788888777888888887888888888888888788888888888888878887888888888888888888888888887887888888888888888888888888888fffffdfffffffeffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff",
+    "8ff8f888f8888888e8888888888888889f88888888888888888888888888888879f888888888888888888888888888888888888888888888888888888888888878a89888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888888",
+    "88dd6868de88de88e8f88888e8f888983888288888888888288827888878a88829888888198888888888888888888888288888881878888878888888b88888880dfe1111311111111eff111111111111111111111111111111111111111111111dff1111111111111eff11111111111110110111110111110111111111111111",
+    "8c98e268e5a1986bf6989b80a4984885df000fff8000ffaf00fff500fff5000f8f088f8880f8f8080f8a8080f8a80f0f8480f8a8080f8a80f8f8580f8c3080f888f888888888888b8888c8889888898888c8888a8888888aa8888a8888c88ea888aa8888c8888c888a888888887c8888d8888888898887b8889f8c888887a888",
+    "88f9df0818f380889e88e883cc8e888878f999966e88888338c88809999966669588f8a85858588a8ae88888888888838c88c888888880a7a85858588a8a858540f800fff00f800ff80ff800f800ff800f80188888888888888888888888888c88c88888c888888888888888888f800f800ff80ff800f800ff800f800ff80ff8",
+    "879aa837c9898d88d99a8a8aaa899999dc5a8c7b8a5b8d5a7c5bef8d7c6b8c78ef6c6e2a4f6f5f3c4f658c2b3f497f2d6f6f6f4f5f6f4f1f5f5b8f3f5f4a4d3598f385fdbcfe5efe57f883f8dbf81fec27f882ef85ffaaed46f888eeb9f8dafc36f8a4f8c8f83cf8eef8fef8cdf88ef838f896fdc9f84cf83bf8c8fedafe6eff",
+    "8c88b2887b6e785768e6b9e887a57968489675885f8b06ba6baa8878587586b768898787680fe277c9386660e0087082e77f8f9287520f77ffef79f8220762fe539a9669a995898986788ff83ccfff200dffd088fff0028ffc208fff208fffc02cff2028fff820cff000afcf8208ff2008f8fc08fff028ffc0c08fff23cff83c",
+    "8cbdc157aa5eab890f1d980b2d1e888399ecfaee8fbfdfef89dfd9cebfaffdefd6078feca81a8ff3e3f8def8cdf1ccb8f519abf88d168ee8f2f8b8f8c8dce8f8f31ed07888f3e838d388f08697f8f883e83ef888c348e888fed8f885d8c8ed88c82eb087e7acf888d4d8d07888ece888f88dd888e3ccf888fd88d3c8e888f888",
+    "8b28a279858a986877aa87f174a75895fd242bbb83240ccf26aac331cad8446b6c35ae39d29db8254b6712a8e0c8450f8764da9270ab8c222de99e1c98a2b8d9aac818c88cb2366f8838e8d8885ac938aacada6c8adb42a6c8cf5a8da638ce888d7c80b7f3836fc9da898371d88a88e8c8d8ac85af4835f8ed8ddc3613aaa2a2",
+    "84b58b1398b7417da5869788c53e98f8788a6896789b5668626ba308a88808689733df7249755fc95c9945a8db8e58e5548854cbb88380af943f6439c00dd85352f1822d0c08d0ca5b14c2438f08cdc08d650b6a31cd8d3c8853c3a8c828a8c8383588c3c8ca28eca33c281b28df2b48d3edae28d5b55f38f2df8f0c32c29c5d",
+    "8ff9f4b8f1998df3f8cabe5873fc088972c33824ece85b155ddd88388388c3e5f088c88c8c88c2cee8c8e88832928ac88bfcd8fcb888838888df8888c883e8c2b80288ccc888883888c88888c83ac858e888c888e88888888382a288888cc833ccacf838d88808c8a3828888888c88888888d80888888888c888888cc888c888",
+    "849ca8e99899078964a7a88b80784868ddf7ffcffdfbfffef9effffdd6cffedf3d1e282208080808080c280808082818281e180c2828082c2c2d6a38583c0328ef88dea83f88cf828f888f888f3c8f888f888f383f888f3c8f888f883d888e883f888e188e888f383f88cf888f883d383fc8cdc8cfdcac88af885d388d8ccf88",
+    "849da6e5a6870678a7a67c99a084599597768c559355afa86e9f6498e380979579d83b8563835832ce268938b8d89838a8586cf3ac265889b88b9e85996a356c8599d391336daa538a3bd88c3d1138c5bc18885482858c33a8dddc88ca2dc42ddcd2c888538308c4838c88253d3c844ea388cce8a2b88888c881da883b3d81fd",
+    "8cc6e799198958a7b056c78a96884a669a8f87979885788d635c6b5552588624c288d2fa41868a68dbaaa68b904266ace633aa41549888d818bc8ba5ee11cc1dcdc82d3cd8880935ca88bbb528d3855af858838c4d2addad818d893554a888c8a8818c38d3885f85c2ca5d3c3c88d8288e1ea33b8898d33da8a88a86c89c8a63",
+    "8ef6f58cf29a2ac4bccb58f124644c290fc838c8cd33288e88afa9c1f14c88edb0f1388883888cc338288c83c08888e888c3d3f823523885c8cf3ec8883358d892c0d881838888888883888822c8388383888d8888c88883c88f88888888e8888888c883888c0888828cc888838888c89c88c8e883e8c8888888838332882888",
+    "868888975a5a9846d79e8558b9965955eeebdeeddfffeffefcfeeeffdeffefea28181d3f15030288080808080c03080c0d040828080c080803130c0803081c5fefcc8e883e28edf8ce388e8c8e88cc888c338f888f88cf888e38cf838f888fc88fd88fca3f88dfc38f338fc88f888f888f8ccf8c3f388f888d8c8f883fc80ff8",
+    "89694786889b8a97634984564e5658628a52d239a9a9a5faf29ba9af022b33e8bbf8c2899d878608bea5a650da65f838b845ddec00caa5888de03d0223e7487aece3f82d3882cc03dcd8ee05e5f68018f05c5fbd0a2efb8721013669f888af1a0588ce279ac2a8388a80aed1e2cd0f8888b3e8808c038082822fe804c188ffc1",
+    "8bb5d79726c78a89622ca1568b867a888965a6f6e0305603d03e3f59d96ca8c9df39763f23f36cebb2878c8da23288b7fc805398d0f8c25828d53e9df25dd5ff934851fbd50724fc828c082ff0c81853808d8800883888022c3fdfd488f0ec02d8c888803d2f1d88d8800888388d3dc3de3c23d8803cce28e8c050f32d32f808",
+    "81a093b3a49aba5fcdcfa89ca883281ba583bcf8833c49c3b8cccc83c578619d58c2888c13c81888cc8c83c82058ec8353c3c83838c888831c38da789971e2d8e8d2c8882d2888388a83c888c088888838c888c88883c888828fc23c4838888c32833883c88883888388c8888888888c81c82cbc7d943433dfea7873a8888888",
+    "8887779766878598967957a68987c79beeeeafeeefefffeffefffdf9cceffdfef8f3dcfaf3e8e5edf3f8fcf8f8f8fcf8f3f8f8f8f8f3e8fff0d8fcf86ceaf3d308cc08830138032c08c40c8815320c880883088828c808880888088808c808883883183c18880888088848830d8808f8088d03cc08c8088800c8138c088c0c8c",
+    "88b5b775d586866ce896a9759665a55955866976a7a5656b7667878688668587df66577797588b6ca6476c854b87796687b697957769a89b665a73787777c8b84704a16764b3396cd554747776d3765585578289945ba77b57ca7a86e3a655394928938772a4858a8aa9a66c5878589694669997faa4776687a98a7f57c4a847",
+};
@@ -29,6 +29,12 @@ void push_console_string(char * string, ...)
     va_end(args);
 
     strncpy(console_buffer[0], buffer, console_width);
+    if (echo_console)
+    {
+        // Workers' lines are interleaved with the main match's on stdout.
+        if (match && match->index > 0) printf("[match %d] %s\n", match->index, buffer);
+        else                           puts(buffer);
+    }
 }
 
 void draw_console()
@@ -144,11 +150,68 @@ bool parse_command(char * string)
         {
             clear_console();
         }
+        else if (CMD(bots))
+        {
+            bots_enabled = !bots_enabled;
+            push_console_string("Bots %s.", bots_enabled ? "enabled" : "disabled");
+        }
+        else if (CMD(snaprate))
+        {
+            if (arg)
+            {
+                int rate = clamp(1, atoi(arg), TICK_RATE);
+                snapshot_interval = TICK_RATE / rate;
+            }
+            push_console_string("Sending %d snapshots per second.", TICK_RATE / snapshot_interval);
+        }
+        else if (CMD(compress))
+        {
+            compress_command(arg);
+        }
+        else if (CMD(allocs))
+        {
+            print_allocation_stats();
+        }
+        else if (CMD(netstat))
+        {
+            netstat_command(arg);
+        }
+        else if (CMD(channels))
+        {
+            channels_command(arg);
+        }
+        else if (CMD(matches))
+        {
+            print_matches();
+        }
+        else if (CMD(bitbench))
+        {
+            bitbench_command();
+        }
+        else if (CMD(combat))
+        {
+            combat_command();
+        }
+        else if (CMD(rate))
+        {
+            rate_command(arg);
+        }
+        else if (CMD(netsim))
+        {
+            netsim_command(arg);
+        }
+        else if (CMD(netthread))
+        {
+            toggle_network_thread();
+        }
         else if (CMD(help))
         {
             push_console_string("Commands: ");
             push_console_string("  quit echo help host clear");
-            push_console_string("  join name fullscreen");
+            push_console_string("  join name fullscreen bots");
+            push_console_string("  netthread netstat netsim channels");
+            push_console_string("  snaprate rate compress allocs matches");
+            push_console_string("  bitbench combat");
         }
         else
         {
@@ -166,6 +229,7 @@ void submit_entry()
 {
     if (entry[0] && entry_index)
     {
+        record_replay_command(entry);
         if (!parse_command(entry) && entry[0] != '/')
         {
             push_console_string(entry);
@@ -161,6 +161,11 @@
     #define ENET_BUFFER_MAXIMUM MSG_MAXIOVLEN
     #endif
 
+    /* recvmmsg and sendmmsg move many datagrams per system call, but are only declared with _GNU_SOURCE. */
+    #if defined(__linux__) && defined(_GNU_SOURCE)
+    #define ENET_SOCKET_BATCHING 1
+    #endif
+
     typedef int ENetSocket;
 
     #define ENET_SOCKET_NULL -1
@@ -491,6 +496,16 @@ extern "C" {
         enet_uint16 sin6_scope_id;
     } ENetAddress;
 
+    /**
+     * A datagram sent or received in a batch, by enet_socket_send_batch and enet_socket_receive_batch.
+     * dataLength is the size of the datagram, or when receiving, the room for it beforehand.
+     */
+    typedef struct _ENetDatagram {
+        ENetAddress address;
+        void *      data;
+        size_t      dataLength;
+    } ENetDatagram;
+
     #define in6_equal(in6_addr_a, in6_addr_b) (memcmp(&in6_addr_a, &in6_addr_b, sizeof(struct in6_addr)) == 0)
 
     /**
@@ -586,6 +601,7 @@ extern "C" {
         ENET_HOST_SEND_BUFFER_SIZE             = 256 * 1024,
         ENET_HOST_BANDWIDTH_THROTTLE_INTERVAL  = 1000,
         ENET_HOST_DEFAULT_MTU                  = 1400,
+        ENET_HOST_DATAGRAM_BATCH               = 32,
         ENET_HOST_DEFAULT_MAXIMUM_PACKET_SIZE  = 32 * 1024 * 1024,
         ENET_HOST_DEFAULT_MAXIMUM_WAITING_DATA = 32 * 1024 * 1024,
 
@@ -715,6 +731,10 @@ extern "C" {
     /** Callback for intercepting received raw UDP packets. Should return 1 to intercept, 0 to ignore, or -1 to propagate an error. */
     typedef int (ENET_CALLBACK * ENetInterceptCallback)(struct _ENetHost *host, void *event);
 
+    /** Callbacks that may stand in for enet_socket_send and enet_socket_receive on a host, taking the same arguments and returning the same results */
+    typedef int (ENET_CALLBACK * ENetSocketSendCallback)(struct _ENetHost *host, const ENetAddress *address, const ENetBuffer *buffers, size_t bufferCount);
+    typedef int (ENET_CALLBACK * ENetSocketReceiveCallback)(struct _ENetHost *host, ENetAddress *address, ENetBuffer *buffers, size_t bufferCount);
+
     /** An ENet host for communicating with peers.
      *
      * No fields should be modified unless otherwise stated.
@@ -762,11 +782,21 @@ extern "C" {
         enet_uint32           totalReceivedData;    /**< total data received, user should reset to 0 as needed to prevent overflow */
         enet_uint32           totalReceivedPackets; /**< total UDP packets received, user should reset to 0 as needed to prevent overflow */
         ENetInterceptCallback intercept;            /**< callback the user can set to intercept received raw UDP packets */
+        ENetSocketSendCallback    socketSend;       /**< callback the user can set to send datagrams in place of the host's socket; the host does not batch while set */
+        ENetSocketReceiveCallback socketReceive;    /**< callback the user can set to receive datagrams in place of the host's socket; the host does not batch while set */
+        void *                    socketContext;    /**< for the socket callbacks' own use */
         size_t                connectedPeers;
         size_t                bandwidthLimitedPeers;
         size_t                duplicatePeers;     /**< optional number of allowed peers from duplicate IPs, defaults to ENET_PROTOCOL_MAXIMUM_PEER_ID */
         size_t                maximumPacketSize;  /**< the maximum allowable packet size that may be sent or received on a peer */
         size_t                maximumWaitingData; /**< the maximum aggregate amount of buffer space a peer may use waiting for packets to be delivered */
+        ENetDatagram *        receivedDatagrams;     /**< datagrams read by the last batched receive, or NULL if the host does not batch */
+        size_t                receivedDatagramCount;
+        size_t                receivedDatagramIndex; /**< the next of receivedDatagrams to be handled */
+        ENetDatagram *        queuedDatagrams;       /**< datagrams waiting for the next batched send, or NULL if the host does not batch */
+        size_t                queuedDatagramCount;
+        enet_uint32           totalReceiveCalls;     /**< socket calls that received at least one datagram, for comparison with totalReceivedPackets */
+        enet_uint32           totalSendCalls;        /**< socket calls that sent at least one datagram, for comparison with totalSentPackets */
     } ENetHost;
 
     /**
@@ -861,6 +891,10 @@ extern "C" {
     ENET_API int        enet_socket_connect(ENetSocket, const ENetAddress *);
     ENET_API int        enet_socket_send(ENetSocket, const ENetAddress *, const ENetBuffer *, size_t);
     ENET_API int        enet_socket_receive(ENetSocket, ENetAddress *, ENetBuffer *, size_t);
+    #ifdef ENET_SOCKET_BATCHING
+    ENET_API int        enet_socket_send_batch(ENetSocket, const ENetDatagram *, size_t);
+    ENET_API int        enet_socket_receive_batch(ENetSocket, ENetDatagram *, size_t);
+    #endif
     ENET_API int        enet_socket_wait(ENetSocket, enet_uint32 *, enet_uint64);
     ENET_API int        enet_socket_set_option(ENetSocket, ENetSocketOption, int);
     ENET_API int        enet_socket_get_option(ENetSocket, ENetSocketOption, int *);
@@ -2587,6 +2621,41 @@ extern "C" {
         return 0;
     } /* enet_protocol_handle_incoming_commands */
 
+    #ifdef ENET_SOCKET_BATCHING
+    /** Takes the next datagram from the last batch received, receiving another batch once it is used up.
+     *  A batch is left part way through whenever an event is returned, so it is finished before the host waits on the socket again.
+     */
+    static int enet_protocol_receive_datagram(ENetHost *host) {
+        ENetDatagram *datagram;
+
+        if (host->receivedDatagramIndex >= host->receivedDatagramCount) {
+            size_t i;
+            int count;
+
+            for (i = 0; i < ENET_HOST_DATAGRAM_BATCH; ++i) {
+                host->receivedDatagrams[i].dataLength = host->mtu;
+            }
+
+            host->receivedDatagramCount = 0;
+            host->receivedDatagramIndex = 0;
+
+            count = enet_socket_receive_batch(host->socket, host->receivedDatagrams, ENET_HOST_DATAGRAM_BATCH);
+            if (count <= 0) {
+                return count;
+            }
+
+            host->receivedDatagramCount = count;
+            host->totalReceiveCalls++;
+        }
+
+        datagram = &host->receivedDatagrams[host->receivedDatagramIndex++];
+        host->receivedAddress = datagram->address;
+        host->receivedData    = (enet_uint8 *) datagram->data;
+
+        return (int) datagram->dataLength;
+    }
+    #endif
+
     static int enet_protocol_receive_incoming_commands(ENetHost *host, ENetEvent *event) {
         int packets;
 
@@ -2594,11 +2663,27 @@ extern "C" {
             int receivedLength;
             ENetBuffer buffer;
 
-            buffer.data       = host->packetData[0];
-            // buffer.dataLength = sizeof (host->packetData[0]);
-            buffer.dataLength = host->mtu;
+            #ifdef ENET_SOCKET_BATCHING
+            if (host->receivedDatagrams != NULL && host->socketReceive == NULL) {
+                receivedLength = enet_protocol_receive_datagram(host);
+            } else
+            #endif
+            {
+                buffer.data       = host->packetData[0];
+                // buffer.dataLength = sizeof (host->packetData[0]);
+                buffer.dataLength = host->mtu;
 
-            receivedLength    = enet_socket_receive(host->socket, &host->receivedAddress, &buffer, 1);
+                if (host->socketReceive != NULL) {
+                    receivedLength = host->socketReceive(host, &host->receivedAddress, &buffer, 1);
+                } else {
+                    receivedLength = enet_socket_receive(host->socket, &host->receivedAddress, &buffer, 1);
+                }
+                host->receivedData = host->packetData[0];
+
+                if (receivedLength > 0) {
+                    host->totalReceiveCalls++;
+                }
+            }
 
             if (receivedLength == -2)
                 continue;
@@ -2611,7 +2696,6 @@ extern "C" {
                 return 0;
             }
 
-            host->receivedData       = host->packetData[0];
             host->receivedDataLength = receivedLength;
 
             host->totalReceivedData += receivedLength;
@@ -2956,7 +3040,13 @@ extern "C" {
         return canPing;
     } /* enet_protocol_send_reliable_outgoing_commands */
 
-    static int enet_protocol_send_outgoing_commands(ENetHost *host, ENetEvent *event, int checkForTimeouts) {
+    #ifdef ENET_SOCKET_BATCHING
+    /** Copies the datagram gathered in host->buffers into the host's batch of datagrams to send, sending the batch first if it is full. */
+    static int enet_protocol_queue_datagram(ENetHost *host, const ENetAddress *address);
+    static int enet_protocol_flush_datagrams(ENetHost *host);
+    #endif
+
+    static int enet_protocol_queue_outgoing_commands(ENetHost *host, ENetEvent *event, int checkForTimeouts) {
         enet_uint8 headerData[sizeof(ENetProtocolHeader) + sizeof(enet_uint32)];
         ENetProtocolHeader *header = (ENetProtocolHeader *) headerData;
         ENetPeer *currentPeer;
@@ -3081,7 +3171,22 @@ extern "C" {
                 }
 
                 currentPeer->lastSendTime = host->serviceTime;
-                sentLength = enet_socket_send(host->socket, &currentPeer->address, host->buffers, host->bufferCount);
+                #ifdef ENET_SOCKET_BATCHING
+                if (host->queuedDatagrams != NULL && host->socketSend == NULL) {
+                    sentLength = enet_protocol_queue_datagram(host, &currentPeer->address);
+                } else
+                #endif
+                {
+                    if (host->socketSend != NULL) {
+                        sentLength = host->socketSend(host, &currentPeer->address, host->buffers, host->bufferCount);
+                    } else {
+                        sentLength = enet_socket_send(host->socket, &currentPeer->address, host->buffers, host->bufferCount);
+                    }
+
+                    if (sentLength > 0) {
+                        host->totalSendCalls++;
+                    }
+                }
                 enet_protocol_remove_sent_unreliable_commands(currentPeer);
 
                 if (sentLength < 0) {
@@ -3094,6 +3199,67 @@ extern "C" {
             }
 
         return 0;
+    } /* enet_protocol_queue_outgoing_commands */
+
+    #ifdef ENET_SOCKET_BATCHING
+    static int enet_protocol_flush_datagrams(ENetHost *host) {
+        size_t sent = 0;
+
+        while (sent < host->queuedDatagramCount) {
+            int count = enet_socket_send_batch(host->socket, &host->queuedDatagrams[sent], host->queuedDatagramCount - sent);
+
+            if (count < 0) {
+                host->queuedDatagramCount = 0;
+                return -1;
+            }
+
+            /* The socket's buffer is full, and the rest are dropped just as unbatched sends would be. */
+            if (count == 0) {
+                break;
+            }
+
+            host->totalSendCalls++;
+            sent += count;
+        }
+
+        host->queuedDatagramCount = 0;
+        return 0;
+    }
+
+    static int enet_protocol_queue_datagram(ENetHost *host, const ENetAddress *address) {
+        ENetDatagram *datagram;
+        enet_uint8 *data;
+        size_t i;
+
+        if (host->queuedDatagramCount == ENET_HOST_DATAGRAM_BATCH && enet_protocol_flush_datagrams(host) < 0) {
+            return -1;
+        }
+
+        datagram = &host->queuedDatagrams[host->queuedDatagramCount++];
+        datagram->address = *address;
+        data = (enet_uint8 *) datagram->data;
+
+        for (i = 0; i < host->bufferCount; ++i) {
+            memcpy(data, host->buffers[i].data, host->buffers[i].dataLength);
+            data += host->buffers[i].dataLength;
+        }
+
+        datagram->dataLength = data - (enet_uint8 *) datagram->data;
+        return (int) datagram->dataLength;
+    }
+    #endif
+
+    /** Sends to every peer whatever it is due, in as few system calls as the host allows. */
+    static int enet_protocol_send_outgoing_commands(ENetHost *host, ENetEvent *event, int checkForTimeouts) {
+        int result = enet_protocol_queue_outgoing_commands(host, event, checkForTimeouts);
+
+        #ifdef ENET_SOCKET_BATCHING
+        if (host->queuedDatagrams != NULL && enet_protocol_flush_datagrams(host) < 0) {
+            return -1;
+        }
+        #endif
+
+        return result;
     } /* enet_protocol_send_outgoing_commands */
 
     /** Sends any queued packets on the host specified to its designated peers.
@@ -4205,6 +4371,27 @@ extern "C" {
      *  the window size of a connection which limits the amount of reliable packets that may be in transit
      *  at any given time.
      */
+    #ifdef ENET_SOCKET_BATCHING
+    /** Allocates a batch of datagrams for a host, each with room for the largest possible datagram. */
+    static ENetDatagram * enet_host_create_datagrams(void) {
+        ENetDatagram *datagrams = (ENetDatagram *) enet_malloc(ENET_HOST_DATAGRAM_BATCH * (sizeof(ENetDatagram) + ENET_PROTOCOL_MAXIMUM_MTU));
+        enet_uint8 *data;
+        size_t i;
+
+        if (datagrams == NULL) {
+            return NULL;
+        }
+
+        data = (enet_uint8 *) &datagrams[ENET_HOST_DATAGRAM_BATCH];
+        for (i = 0; i < ENET_HOST_DATAGRAM_BATCH; ++i) {
+            datagrams[i].data       = data + i * ENET_PROTOCOL_MAXIMUM_MTU;
+            datagrams[i].dataLength = 0;
+        }
+
+        return datagrams;
+    }
+    #endif
+
     ENetHost * enet_host_create(const ENetAddress *address, size_t peerCount, size_t channelLimit, enet_uint32 incomingBandwidth, enet_uint32 outgoingBandwidth) {
         ENetHost *host;
         ENetPeer *currentPeer;
@@ -4288,6 +4475,20 @@ extern "C" {
         host->compressor.decompress         = NULL;
         host->compressor.destroy            = NULL;
         host->intercept                     = NULL;
+        host->socketSend                    = NULL;
+        host->socketReceive                 = NULL;
+        host->socketContext                 = NULL;
+        host->receivedDatagrams             = NULL;
+        host->queuedDatagrams               = NULL;
+
+        #ifdef ENET_SOCKET_BATCHING
+        /* A host with a single peer rarely has more than one datagram to move at a time, so only larger hosts batch.
+         * If either batch cannot be allocated, the host falls back to a system call per datagram for that direction. */
+        if (peerCount > 1) {
+            host->receivedDatagrams = enet_host_create_datagrams();
+            host->queuedDatagrams   = enet_host_create_datagrams();
+        }
+        #endif
 
         enet_list_clear(&host->dispatchQueue);
 
@@ -4330,6 +4531,14 @@ extern "C" {
             (*host->compressor.destroy)(host->compressor.context);
         }
 
+        if (host->receivedDatagrams != NULL) {
+            enet_free(host->receivedDatagrams);
+        }
+
+        if (host->queuedDatagrams != NULL) {
+            enet_free(host->queuedDatagrams);
+        }
+
         enet_free(host->peers);
         enet_free(host);
     }
@@ -5117,6 +5326,108 @@ extern "C" {
         return recvLength;
     } /* enet_socket_receive */
 
+    #ifdef ENET_SOCKET_BATCHING
+
+    /** Sends as many of the datagrams as the socket will take, with one system call.
+     *  @returns the number of datagrams sent, 0 if the socket would block, or -1 on failure
+     */
+    int enet_socket_send_batch(ENetSocket socket, const ENetDatagram *datagrams, size_t datagramCount) {
+        struct mmsghdr messages[ENET_HOST_DATAGRAM_BATCH];
+        struct sockaddr_in6 sins[ENET_HOST_DATAGRAM_BATCH];
+        struct iovec iovecs[ENET_HOST_DATAGRAM_BATCH];
+        size_t i;
+        int sentCount;
+
+        datagramCount = ENET_MIN(datagramCount, ENET_HOST_DATAGRAM_BATCH);
+        memset(messages, 0, datagramCount * sizeof(struct mmsghdr));
+        memset(sins, 0, datagramCount * sizeof(struct sockaddr_in6));
+
+        for (i = 0; i < datagramCount; ++i) {
+            sins[i].sin6_family   = AF_INET6;
+            sins[i].sin6_port     = ENET_HOST_TO_NET_16(datagrams[i].address.port);
+            sins[i].sin6_addr     = datagrams[i].address.host;
+            sins[i].sin6_scope_id = datagrams[i].address.sin6_scope_id;
+
+            iovecs[i].iov_base = datagrams[i].data;
+            iovecs[i].iov_len  = datagrams[i].dataLength;
+
+            messages[i].msg_hdr.msg_name    = &sins[i];
+            messages[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in6);
+            messages[i].msg_hdr.msg_iov     = &iovecs[i];
+            messages[i].msg_hdr.msg_iovlen  = 1;
+        }
+
+        sentCount = sendmmsg(socket, messages, datagramCount, MSG_NOSIGNAL);
+
+        if (sentCount == -1) {
+            if (errno == EWOULDBLOCK) {
+                return 0;
+            }
+
+            return -1;
+        }
+
+        return sentCount;
+    } /* enet_socket_send_batch */
+
+    /** Receives as many datagrams as are waiting, up to datagramCount, with one system call.
+     *  Any too large for their buffer are dropped, and the rest moved to the front of datagrams.
+     *  @returns the number of datagrams received, 0 if there were none, or -1 on failure
+     */
+    int enet_socket_receive_batch(ENetSocket socket, ENetDatagram *datagrams, size_t datagramCount) {
+        struct mmsghdr messages[ENET_HOST_DATAGRAM_BATCH];
+        struct sockaddr_in6 sins[ENET_HOST_DATAGRAM_BATCH];
+        struct iovec iovecs[ENET_HOST_DATAGRAM_BATCH];
+        int i, receivedCount, keptCount = 0;
+
+        datagramCount = ENET_MIN(datagramCount, ENET_HOST_DATAGRAM_BATCH);
+        memset(messages, 0, datagramCount * sizeof(struct mmsghdr));
+
+        for (i = 0; i < (int) datagramCount; ++i) {
+            iovecs[i].iov_base = datagrams[i].data;
+            iovecs[i].iov_len  = datagrams[i].dataLength;
+
+            messages[i].msg_hdr.msg_name    = &sins[i];
+            messages[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in6);
+            messages[i].msg_hdr.msg_iov     = &iovecs[i];
+            messages[i].msg_hdr.msg_iovlen  = 1;
+        }
+
+        receivedCount = recvmmsg(socket, messages, datagramCount, MSG_NOSIGNAL, NULL);
+
+        if (receivedCount == -1) {
+            if (errno == EWOULDBLOCK) {
+                return 0;
+            }
+
+            return -1;
+        }
+
+        /* A truncated datagram is dropped on its own, and those after it are moved up in its place,
+         * along with the buffers they were received into. */
+        for (i = 0; i < receivedCount; ++i) {
+            if (messages[i].msg_hdr.msg_flags & MSG_TRUNC) {
+                continue;
+            }
+
+            if (keptCount != i) {
+                ENetDatagram truncated = datagrams[keptCount];
+                datagrams[keptCount] = datagrams[i];
+                datagrams[i] = truncated;
+            }
+
+            datagrams[keptCount].address.host          = sins[i].sin6_addr;
+            datagrams[keptCount].address.port          = ENET_NET_TO_HOST_16(sins[i].sin6_port);
+            datagrams[keptCount].address.sin6_scope_id = sins[i].sin6_scope_id;
+            datagrams[keptCount].dataLength            = messages[i].msg_len;
+            ++keptCount;
+        }
+
+        return keptCount;
+    } /* enet_socket_receive_batch */
+
+    #endif // ENET_SOCKET_BATCHING
+
     int enet_socketset_select(ENetSocket maxSocket, ENetSocketSet *readSet, ENetSocketSet *writeSet, enet_uint32 timeout) {
         struct timeval timeVal;
 
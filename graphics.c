@@ -38,7 +38,7 @@ void toggle_fullscreen()
 
 void display_screen()
 {
-    SDL_Delay(1);
+    if (!replay_playing) SDL_Delay(1);
     SDL_RenderClear(renderer);
     SDL_UpdateTexture(screen_texture, NULL, screen_pixels, screen_width * sizeof(*screen_pixels));
     SDL_RenderCopy(renderer, screen_texture, NULL, NULL);
@@ -326,35 +326,44 @@ void render_player_view(Player * player)
     }
 }
 
-void render_players()
+typedef struct
 {
-    // TODO: Make this faster if we want to support more players.
-    bool rendered[max_players] = {false};
-    for (int i = 0; i < player_count; ++i)
+    f32 distance;
+    int index;
+}
+Sprite_Order;
+
+int compare_sprite_order(const void * a, const void * b)
+{
+    f32 x = ((const Sprite_Order *)a)->distance;
+    f32 y = ((const Sprite_Order *)b)->distance;
+    return (x < y) - (x > y);
+}
+
+// Draw every visible player, from the furthest to the nearest.
+void render_players(Player * states, Player * player)
+{
+    Sprite_Order order[player_count];
+    int count = 0;
+    for (int player_index = 0; player_index < player_count; ++player_index)
     {
+        Player * p = states + player_index;
+        f32 distance = dist2(p->x, p->y, player->x, player->y);
         // No players closer than this value will be drawn.
-        f32 furthest_distance = 0.2f;
-        int furthest_index = -1;
-        for (int player_index = 0; player_index < player_count; ++player_index)
+        if (p != player && !p->hidden && distance > 0.2f)
         {
-            Player * p = players + player_index;
-            if (p != player && !rendered[player_index])
-            {
-                f32 distance = dist2(p->x, p->y, player->x, player->y);
-                if (distance > furthest_distance)
-                {
-                    furthest_distance = distance;
-                    furthest_index = player_index;
-                }
-            }
+            order[count++] = (Sprite_Order){ distance, player_index };
         }
-        if (furthest_index == -1) break;
-        Player * furthest_player = players + furthest_index;
-        render_sprite(furthest_player->x, furthest_player->y,
-            sprite_pixels + (furthest_player->sprite_index * sprite_size),
+    }
+    qsort(order, count, sizeof(*order), compare_sprite_order);
+
+    for (int i = 0; i < count; ++i)
+    {
+        Player * p = states + order[i].index;
+        render_sprite(p->x, p->y,
+            sprite_pixels + (p->sprite_index * sprite_size),
             sprite_size, sprite_pitch,
             player);
-        rendered[furthest_index] = true;
     }
 }
 
@@ -0,0 +1,54 @@
+/*
+    Labyrinth
+    Benedict Henshaw, 2018
+    interest.c - Deciding which players each client needs to hear about.
+*/
+
+// Each tick the server asks, for every client, how much each other player
+// matters to them. Players that are too far away, or hidden behind walls, do
+// not matter at all and are left out of that client's snapshots entirely. The
+// rest are ranked: nearer players first, and players in front of the viewer
+// ahead of those behind. A client's bandwidth then depends on what it can
+// see, rather than on how many players there are.
+
+// Players this close are always relevant, even out of sight, so that someone
+// stepping around a corner is already up to date when they appear.
+#define INTEREST_NEAR_DISTANCE 2.0f
+
+// Players outside the view cone still matter, since turning around is quick,
+// but less so than those the viewer is looking at.
+#define INTEREST_BEHIND_SCALE 0.25f
+
+// Whether the straight line between two points is clear of walls.
+bool line_of_sight(f32 from_x, f32 from_y, f32 to_x, f32 to_y)
+{
+    f32 distance = dist2(from_x, from_y, to_x, to_y);
+    f32 angle = atan2f(to_y - from_y, to_x - from_x);
+    return cast_ray(from_x, from_y, angle, distance) >= distance;
+}
+
+// How much the viewer should hear about the target this tick, or zero if it
+// should not hear about them at all.
+f32 player_interest(int viewer, int target)
+{
+    if (!players.in_use[target]) return 0.0f;
+    f32 offset_x = players.x[target] - players.x[viewer];
+    f32 offset_y = players.y[target] - players.y[viewer];
+    f32 distance = sqrtf(offset_x * offset_x + offset_y * offset_y);
+
+    if (distance > view_distance) return 0.0f;
+    if (distance > INTEREST_NEAR_DISTANCE &&
+        !line_of_sight(players.x[viewer], players.y[viewer], players.x[target], players.y[target]))
+    {
+        return 0.0f;
+    }
+
+    f32 interest = 1.0f / (1.0f + distance);
+
+    // The cone is twice as wide as the view, as the server does not know each
+    // client's exact field of view, and a margin hides any turn in flight.
+    f32 facing = offset_x * players.facing_x[viewer] + offset_y * players.facing_y[viewer];
+    if (facing < cosf(min(view_angle, PI)) * distance) interest *= INTEREST_BEHIND_SCALE;
+
+    return interest;
+}
@@ -0,0 +1,201 @@
+/*
+    Labyrinth
+    Benedict Henshaw, 2018
+    interpolation.c - Drawing remote players smoothly between snapshots.
+*/
+
+// Snapshots arrive unevenly, and not necessarily on every tick, so remote
+// players are not drawn where the latest snapshot put them. Instead each keeps
+// a short history of where it was at each server time, and is drawn where it
+// was interpolation_delay seconds ago, blended between the samples either side
+// of that moment.
+//
+// The delay adapts to the connection. Each snapshot's arrival is compared with
+// when it was due, according to a running estimate of the offset between the
+// server's clock and ours, and the delay is kept at the usual gap between
+// snapshots plus a few times the average amount they were early or late. If a
+// player's history runs out anyway, they carry on along their last velocity
+// for up to MAX_EXTRAPOLATION seconds, and then stop.
+
+#define REMOTE_HISTORY 32
+
+// How many times the measured jitter to wait, on top of the snapshot gap.
+#define JITTER_MARGIN 3.0
+#define MAX_INTERPOLATION_DELAY 0.5
+#define MAX_EXTRAPOLATION 0.1
+
+// How far the clock estimates move towards each new measurement.
+#define CLOCK_SMOOTHING 0.05
+
+typedef struct
+{
+    f64 time;
+    f32 x;
+    f32 y;
+    f32 angle;
+}
+Remote_Sample;
+
+typedef struct
+{
+    Remote_Sample samples[REMOTE_HISTORY];
+    int newest;
+    int count;
+}
+Remote_History;
+
+MATCH_LOCAL Remote_History * remote_histories;
+
+// Server time is measured in ticks, unwrapped from the 16 bits in each snapshot.
+MATCH_LOCAL u64 latest_server_tick;
+MATCH_LOCAL bool clock_started = false;
+// Server time minus local time, in seconds.
+MATCH_LOCAL f64 clock_offset;
+MATCH_LOCAL f64 clock_jitter;
+MATCH_LOCAL f64 snapshot_gap;
+MATCH_LOCAL f64 interpolation_delay;
+
+f64 get_seconds()
+{
+    return SDL_GetPerformanceCounter() / (f64)SDL_GetPerformanceFrequency();
+}
+
+void resize_remote_histories(int capacity)
+{
+    remote_histories = resize_player_array(remote_histories, sizeof(*remote_histories), player_capacity, capacity);
+}
+
+void reset_interpolation()
+{
+    clock_started = false;
+    for (int i = 0; i < player_capacity; ++i)
+    {
+        remote_histories[i].count = 0;
+    }
+}
+
+// Add the players in the latest snapshot to their histories, and update the
+// clock estimates from when it arrived.
+void record_remote_samples()
+{
+    Snapshot * snapshot = received_snapshots + (latest_snapshot_sequence % SNAPSHOT_HISTORY);
+    f64 now = get_seconds();
+
+    u64 previous_tick = latest_server_tick;
+    if (clock_started) latest_server_tick += (s16)(snapshot->tick - (u16)latest_server_tick);
+    else               latest_server_tick = snapshot->tick;
+    f64 server_time = latest_server_tick * (f64)TICK_DURATION;
+    f64 offset = server_time - now;
+
+    if (clock_started)
+    {
+        // Snapshots that were held up make the offset look smaller than it
+        // is, and those that were not make it look larger.
+        f64 deviation = offset - clock_offset;
+        clock_offset += deviation * CLOCK_SMOOTHING;
+        clock_jitter += (fabs(deviation) - clock_jitter) * CLOCK_SMOOTHING;
+        f64 gap = (latest_server_tick - previous_tick) * (f64)TICK_DURATION;
+        snapshot_gap += (gap - snapshot_gap) * CLOCK_SMOOTHING;
+    }
+    else
+    {
+        clock_offset = offset;
+        clock_jitter = 0.0;
+        snapshot_gap = TICK_DURATION;
+        clock_started = true;
+    }
+
+    f64 target_delay = min(snapshot_gap + JITTER_MARGIN * clock_jitter, MAX_INTERPOLATION_DELAY);
+    interpolation_delay += (target_delay - interpolation_delay) * CLOCK_SMOOTHING;
+
+    for (int i = 0; i < min(snapshot->entity_count, player_count); ++i)
+    {
+        Remote_History * history = remote_histories + i;
+        if (i == local_player || players.hidden[i])
+        {
+            history->count = 0;
+            continue;
+        }
+        history->newest = (history->newest + 1) % REMOTE_HISTORY;
+        history->samples[history->newest] = (Remote_Sample){
+            .time = server_time,
+            .x = players.x[i],
+            .y = players.y[i],
+            .angle = players.angle[i],
+        };
+        history->count = min(history->count + 1, REMOTE_HISTORY);
+    }
+}
+
+// Blend between two samples, unless the player teleported between them.
+void blend_remote_samples(Player * player, Remote_Sample * from, Remote_Sample * to, f32 t)
+{
+    if (fabsf(to->x - from->x) < 1.0f && fabsf(to->y - from->y) < 1.0f)
+    {
+        player->x = from->x + (to->x - from->x) * t;
+        player->y = from->y + (to->y - from->y) * t;
+        player->angle = from->angle + remainderf(to->angle - from->angle, TWO_PI) * t;
+    }
+    else
+    {
+        Remote_Sample * nearest = t < 0.5f ? from : to;
+        player->x = nearest->x;
+        player->y = nearest->y;
+        player->angle = nearest->angle;
+    }
+}
+
+// Replace where every remote player is drawn with where their history says
+// they were interpolation_delay seconds ago.
+void sample_remote_players(Player * states)
+{
+    if (!clock_started) return;
+    f64 render_time = get_seconds() + clock_offset - interpolation_delay;
+
+    for (int i = 0; i < player_count; ++i)
+    {
+        Remote_History * history = remote_histories + i;
+        if (i == local_player || history->count == 0) continue;
+
+        // Walk back from the newest sample to the last one before render_time.
+        Remote_Sample * before = NULL;
+        Remote_Sample * after = NULL;
+        for (int k = 0; k < history->count; ++k)
+        {
+            Remote_Sample * sample = history->samples + (history->newest - k + REMOTE_HISTORY) % REMOTE_HISTORY;
+            if (sample->time <= render_time)
+            {
+                before = sample;
+                break;
+            }
+            after = sample;
+        }
+
+        Player * player = states + i;
+        if (before && after)
+        {
+            f32 t = (render_time - before->time) / (after->time - before->time);
+            blend_remote_samples(player, before, after, t);
+        }
+        else if (before && history->count >= 2)
+        {
+            // Nothing newer has arrived yet, so guess from the last two.
+            Remote_Sample * previous = history->samples + (history->newest - 1 + REMOTE_HISTORY) % REMOTE_HISTORY;
+            f64 ahead = min(render_time - before->time, MAX_EXTRAPOLATION);
+            f32 t = 1.0f + ahead / max(before->time - previous->time, TICK_DURATION);
+            blend_remote_samples(player, previous, before, t);
+            // Never guess a player into a wall.
+            if (player->x < 0.0f || player->x >= map_width ||
+                player->y < 0.0f || player->y >= map_height ||
+                map[(int)player->x + (int)player->y * map_width] != ' ')
+            {
+                blend_remote_samples(player, before, before, 0.0f);
+            }
+        }
+        else
+        {
+            Remote_Sample * oldest = before ? before : after;
+            blend_remote_samples(player, oldest, oldest, 0.0f);
+        }
+    }
+}
@@ -5,10 +5,13 @@
              and includes live.
 */
 
+// For recvmmsg and sendmmsg in enet.h, on Linux.
+#define _GNU_SOURCE
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 #include <time.h>
 #include <math.h>
 
@@ -16,6 +19,9 @@
 #define assert(...) SDL_assert(__VA_ARGS__)
 #define ENET_IMPLEMENTATION
 #include "enet.h"
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
@@ -57,13 +63,36 @@ typedef struct
     f32 angle;
     f32 speed;
     int sprite_index;
+    bool hidden;
 }
 Player;
 
+// What a player asked to do on one tick: which movement buttons were held,
+// and which way they were facing.
+#define INPUT_UP    (1 << 0)
+#define INPUT_DOWN  (1 << 1)
+#define INPUT_LEFT  (1 << 2)
+#define INPUT_RIGHT (1 << 3)
+#define INPUT_BUTTON_BITS 4
+
+typedef struct
+{
+    u16 sequence;
+    u8 buttons;
+    f32 angle;
+}
+Player_Input;
+
 //
 // GLOBALS
 //
 
+// Everything that belongs to a single match is MATCH_LOCAL: each thread that
+// runs a match has its own copy. Anything else is shared by the whole
+// process, and is either set up before any match starts or only touched from
+// the main thread. See match.c.
+#define MATCH_LOCAL _Thread_local
+
 SDL_Window * window;
 SDL_Renderer * renderer;
 SDL_Texture * screen_texture;
@@ -76,6 +105,11 @@ int screen_width  = 256;
 int screen_height = 256;
 int screen_scale  = 1;
 
+// Run without a window, such as for a dedicated server or replay playback.
+bool headless = false;
+MATCH_LOCAL bool echo_console = false;
+bool replay_playing = false;
+
 u32 * texture_pixels;
 int texture_size;
 int texture_count;
@@ -96,23 +130,137 @@ f32 view_angle    = M_PI / 3.0f * (480.0f / 640.0f);
 
 f32 turn_speed = 0.005f;
 
-bool pressing_up    = false;
-bool pressing_down  = false;
-bool pressing_left  = false;
-bool pressing_right = false;
-
-const int max_players = 8;
+// The simulation always advances in steps of exactly TICK_DURATION seconds, no
+// matter how fast frames are drawn, so that it plays out identically everywhere.
+#define TICK_RATE 60
+#define TICK_DURATION (1.0f / TICK_RATE)
+// Longest frame the simulation will try to catch up on.
+#define MAX_FRAME_TIME 0.25f
+MATCH_LOCAL u64 tick_count = 0;
+
+MATCH_LOCAL bool pressing_up    = false;
+MATCH_LOCAL bool pressing_down  = false;
+MATCH_LOCAL bool pressing_left  = false;
+MATCH_LOCAL bool pressing_right = false;
+
+// Players are added and removed as clients come and go, up to max_players,
+// which can be raised to PLAYER_LIMIT with "--max-players". Bots fill in for
+// missing players until there are at least minimum_players.
+#define PLAYER_LIMIT 1024
+int max_players = 256;
+int minimum_players = 8;
 char player_name[16];
-ENetHost * local_host;
-ENetPeer * remote_server;
-int network_mode = 0;
+MATCH_LOCAL ENetHost * local_host;
+MATCH_LOCAL ENetPeer * remote_server;
+MATCH_LOCAL int network_mode = 0;
 #define NETMODE_CLIENT 1
 #define NETMODE_SERVER 2
 #define DEFAULT_PORT 12921
+// The fewest ticks between the snapshots a server sends each client. Clients
+// on poor connections are sent them less often; see rate.c.
+int snapshot_interval = 2;
+
+// The first byte of every message says what kind of message it is.
+enum
+{
+    MESSAGE_CHAT,
+    MESSAGE_WELCOME,
+    MESSAGE_SNAPSHOT,
+    MESSAGE_CLIENT_INPUT,
+    MESSAGE_BATCH,
+    MESSAGE_PING,
+    MESSAGE_PONG,
+    MESSAGE_SHOOT,
+    MESSAGE_KILL,
+};
+
+// Events that must all arrive, in order: chat, welcomes, shots, kills.
+#define CHANNEL_RELIABLE    0
+// State that is superseded by the next of its kind: snapshots and inputs.
+#define CHANNEL_UNRELIABLE  1
+// Messages that stand alone and may arrive in any order: pings and pongs.
+#define CHANNEL_UNSEQUENCED 2
+#define CHANNEL_COUNT       3
+
+// What was known of a connection on one tick. See netstat.c.
+typedef struct
+{
+    f32 round_trip_time;
+    f32 round_trip_variance;
+    f32 packet_loss;
+    f32 throttle;
+    // Running totals, as of this tick.
+    u32 bytes_sent;
+    u32 bytes_received;
+    u32 messages_sent;
+    u32 messages_received;
+}
+Net_Sample;
+
+#define NETSTAT_HISTORY 128
+
+typedef struct
+{
+    u32 bytes_received;
+    u32 messages_received;
+    Net_Sample samples[NETSTAT_HISTORY];
+    int newest;
+    int count;
+}
+Peer_Telemetry;
+
+// How often, and how much, a server is sending a client. See rate.c.
+typedef struct
+{
+    // Ticks between snapshots.
+    int interval;
+    // Most bytes in each snapshot.
+    int budget;
+    u64 last_snapshot_tick;
+    // Since the rate was last adjusted.
+    int snapshots_acked;
+    int snapshots_missed;
+    f32 lowest_round_trip;
+    int healthy_periods;
+    bool congested;
+}
+Send_Rate;
+
+// How quickly a client may fire. See combat.c.
+typedef struct
+{
+    // Shots the client may fire straight away, and when that was worked out.
+    f32 allowance;
+    u64 refilled_tick;
+    // The input on which the client last fired.
+    u16 last_input;
+    bool has_fired;
+}
+Fire_Limit;
+
+// One of the matches hosted by this process. See match.c.
+typedef struct
+{
+    int index;
+    u16 port;
+    u64 seed[2];
+    SDL_Thread * thread;
+    SDL_atomic_t running;
+    // Published by the match's own thread every tick.
+    SDL_atomic_t client_count;
+    SDL_atomic_t player_count;
+    SDL_atomic_t tick_microseconds;
+}
+Match;
+
+Match * matches;
+int match_count = 0;
+// The match that the current thread is running, once there is more than one.
+MATCH_LOCAL Match * match;
 
 const int console_line_count = 12;
 const int console_width = 128;
-char console_buffer[console_line_count][console_width];
+MATCH_LOCAL char console_buffer[console_line_count][console_width];
 
 char previous_entry[console_width] = {};
 char entry[console_width] = {};
@@ -138,12 +286,61 @@ char map[] =
     "0 0000000      0"
     "0              0"
     "0002222222200000";
+f32 solid_tiles[sizeof(map)];
+
+// Every player's state, kept as a structure of arrays so that the simulation
+// can move a whole batch of players with the same instructions. Arrays hold
+// player_capacity players, a whole number of batches, and grow as players are
+// added. Slots past player_count, and those of removed players, are left idle.
+// No two arrays ever overlap, and saying so lets the compiler vectorise the
+// movement kernel without checking. The Player struct holds a copy of a
+// single player's state.
+#define PLAYER_BATCH_SIZE 8
+typedef struct
+{
+    f32 * restrict x;
+    f32 * restrict y;
+    f32 * restrict walk;
+    f32 * restrict walk_acceleration;
+    f32 * restrict strafe;
+    f32 * restrict strafe_acceleration;
+    f32 * restrict angle;
+    // Cached cosf and sinf of angle, kept in sync by set_player_angle.
+    f32 * restrict facing_x;
+    f32 * restrict facing_y;
+    f32 * restrict speed;
+    // Position as of the previous tick, used to interpolate rendering.
+    f32 * restrict previous_x;
+    f32 * restrict previous_y;
+    int * restrict sprite_index;
+    // Set for players that are not drawn or hit: on clients, those the server
+    // has stopped telling them about, and everywhere, removed players.
+    bool * restrict hidden;
+    // Whether the slot holds a player, rather than a gap left by one removed.
+    bool * restrict in_use;
+}
+Player_Store;
+
+MATCH_LOCAL Player_Store players;
+MATCH_LOCAL Player * interpolated_players;
+// Slots ever used, and slots allocated.
+MATCH_LOCAL int player_count = 0;
+MATCH_LOCAL int player_capacity = 0;
+MATCH_LOCAL int local_player = 0;
+bool bots_enabled = true;
+
+// The local player's input for the most recent tick.
+MATCH_LOCAL Player_Input local_input;
 
-Player players[max_players];
-int player_count = 8;
-Player * player = players;
+// When a client's prediction is corrected, the local player is drawn offset
+// by the difference, which then fades out over a few ticks.
+MATCH_LOCAL f32 prediction_error_x;
+MATCH_LOCAL f32 prediction_error_y;
+#define PREDICTION_ERROR_DECAY 0.85f
 
 #define MIN_DISTANCE_FROM_WALL 0.1f
+#define PLAYER_RADIUS 0.25f
+#define PLAYER_SPRITE_COUNT 8
 
 //
 // A small handful of functions that are referenced across multiple files.
@@ -155,6 +352,31 @@ void join_network(char * address_with_optional_port);
 void set_player_name(char * name);
 void toggle_fullscreen();
 void send_string_over_network(char * string);
+void toggle_network_thread();
+void send_packet(ENetPeer * peer, u32 connect_id, int channel, ENetPacket * packet);
+void compress_command(char * argument);
+void channels_command(char * argument);
+void print_allocation_stats();
+void netstat_command(char * argument);
+void netsim_command(char * argument);
+void rate_command(char * argument);
+void print_matches();
+void bitbench_command();
+void start_network_thread();
+void stop_network_thread();
+void update_bots();
+void remove_bot(int player_index);
+void resize_bots(int capacity);
+void resize_remote_histories(int capacity);
+void resize_client_snapshots(int capacity);
+void resize_rewind_history(int capacity);
+void record_rewind_frame();
+void send_shot(f32 angle);
+void queue_local_shot(f32 angle);
+void resolve_shots();
+void combat_command();
+void apply_client_inputs();
+void record_replay_command(char * string);
 
 //
 // LOCAL INCLUDES
@@ -163,8 +385,28 @@ void send_string_over_network(char * string);
 #include "common.c"
 #include "console.c"
 #include "graphics.c"
-#include "network.c"
 #include "player.c"
+#include "bots.c"
+#include "bits.c"
+#include "pool.c"
+#include "outbox.c"
+#include "interest.c"
+#include "snapshot.c"
+#include "prediction.c"
+#include "interpolation.c"
+#include "rewind.c"
+#include "combat.c"
+#include "queue.c"
+#include "netsim.c"
+#include "reactor.c"
+#include "compress.c"
+#include "netstat.c"
+#include "rate.c"
+#include "network.c"
+#include "match.c"
+#include "replay.c"
+#include "swarm.c"
+#include "bitbench.c"
 
 void audio_callback(void * data, u8 * stream, int byte_count)
 {
@@ -173,65 +415,156 @@ void audio_callback(void * data, u8 * stream, int byte_count)
 
 int main(int argument_count, char ** arguments)
 {
-    if (SDL_Init(SDL_INIT_VIDEO) != 0)
+    char * record_file_name = NULL;
+    char * replay_file_name = NULL;
+    int host_port = -1;
+    int hosted_matches = 1;
+    for (int i = 1; i < argument_count; ++i)
     {
-        panic_exit("Could not initialise SDL2\n%s", SDL_GetError());
+        if (strcmp(arguments[i], "--headless") == 0)
+        {
+            headless = true;
+        }
+        else if (strcmp(arguments[i], "--record") == 0 && i + 1 < argument_count)
+        {
+            record_file_name = arguments[++i];
+        }
+        else if (strcmp(arguments[i], "--replay") == 0 && i + 1 < argument_count)
+        {
+            replay_file_name = arguments[++i];
+        }
+        else if (strcmp(arguments[i], "--host") == 0 && i + 1 < argument_count)
+        {
+            host_port = atoi(arguments[++i]);
+        }
+        else if (strcmp(arguments[i], "--max-players") == 0 && i + 1 < argument_count)
+        {
+            max_players = atoi(arguments[++i]);
+            max_players = clamp(1, max_players, PLAYER_LIMIT);
+            minimum_players = min(minimum_players, max_players);
+        }
+        else if (strcmp(arguments[i], "--matches") == 0 && i + 1 < argument_count)
+        {
+            hosted_matches = atoi(arguments[++i]);
+            hosted_matches = max(1, hosted_matches);
+            if (host_port < 0) host_port = 0;
+        }
+        else if (strcmp(arguments[i], "--bandwidth") == 0 && i + 1 < argument_count)
+        {
+            server_bandwidth = atoi(arguments[++i]);
+            server_bandwidth = max(0, server_bandwidth);
+        }
+        else if (strcmp(arguments[i], "--netsim") == 0 && i + 1 < argument_count)
+        {
+            if (!set_netsim_profile(arguments[++i])) panic_exit("No network profile named '%s'.", arguments[i]);
+        }
+        else if (strcmp(arguments[i], "--swarm") == 0 && i + 1 < argument_count)
+        {
+            swarm_size = atoi(arguments[++i]);
+            headless = true;
+        }
+        else if (strcmp(arguments[i], "--duration") == 0 && i + 1 < argument_count)
+        {
+            swarm_duration = strtod(arguments[++i], NULL);
+        }
+        else if (strcmp(arguments[i], "--input-rate") == 0 && i + 1 < argument_count)
+        {
+            swarm_input_rate = strtod(arguments[++i], NULL);
+        }
+        else if (strcmp(arguments[i], "--chat-rate") == 0 && i + 1 < argument_count)
+        {
+            swarm_chat_rate = strtod(arguments[++i], NULL);
+        }
+        else if (strcmp(arguments[i], "--fire-rate") == 0 && i + 1 < argument_count)
+        {
+            swarm_fire_rate = strtod(arguments[++i], NULL);
+        }
+        else
+        {
+            printf("Usage: %s [--headless] [--record file | --replay file] [--host port] [--max-players count]\n"
+                   "       [--matches count] [--bandwidth bytes] [--netsim profile]\n"
+                   "       [--swarm count [--duration seconds] [--input-rate hz] [--chat-rate hz]\n"
+                   "                      [--fire-rate hz]]\n",
+                   arguments[0]);
+            exit(1);
+        }
     }
 
-    SDL_Rect display_bounds;
-    SDL_GetDisplayBounds(0, &display_bounds);
-    // screen_width  = display_bounds.w / screen_scale;
-    // screen_height = display_bounds.h / screen_scale;
-
-    window = SDL_CreateWindow("",
-        SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
-        screen_width * screen_scale, screen_height * screen_scale,
-        SDL_WINDOW_ALLOW_HIGHDPI);
-    if (!window) panic_exit("Could not create window\n%s", SDL_GetError());
-
-    renderer = SDL_CreateRenderer(window, -1,
-        SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
-    if (!renderer) panic_exit("Could not create renderer\n%s", SDL_GetError());
+    if (SDL_Init(headless ? 0 : SDL_INIT_VIDEO) != 0)
+    {
+        panic_exit("Could not initialise SDL2\n%s", SDL_GetError());
+    }
 
-    init_screen(screen_width, screen_height);
+    if (!headless)
+    {
+        SDL_Rect display_bounds;
+        SDL_GetDisplayBounds(0, &display_bounds);
+        // screen_width  = display_bounds.w / screen_scale;
+        // screen_height = display_bounds.h / screen_scale;
+
+        window = SDL_CreateWindow("",
+            SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+            screen_width * screen_scale, screen_height * screen_scale,
+            SDL_WINDOW_ALLOW_HIGHDPI);
+        if (!window) panic_exit("Could not create window\n%s", SDL_GetError());
+
+        // Replays play back as fast as possible, so should not wait for vsync.
+        renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED
+            | (replay_file_name ? 0 : SDL_RENDERER_PRESENTVSYNC));
+        if (!renderer) panic_exit("Could not create renderer\n%s", SDL_GetError());
+
+        init_screen(screen_width, screen_height);
+
+        load_textures("data/textures.png");
+        load_sprites("data/sprites.png");
+        load_font("data/font_6x12.png");
+
+        SDL_WarpMouseInWindow(window, screen_width / 2, screen_height / 2);
+        SDL_SetRelativeMouseMode(true);
+        SDL_ShowCursor(false);
+    }
 
-    load_textures("data/textures.png");
-    load_sprites("data/sprites.png");
-    load_font("data/font_6x12.png");
+    // Without a window, console output is only visible on stdout.
+    echo_console = headless || replay_file_name;
 
     init_network();
 
-    SDL_WarpMouseInWindow(window, screen_width / 2, screen_height / 2);
-    SDL_SetRelativeMouseMode(true);
-    SDL_ShowCursor(false);
-
     u64 previous_counter_ticks = SDL_GetPerformanceCounter();
     f32 counter_ticks_per_second = SDL_GetPerformanceFrequency();
 
-    set_seed(SDL_GetTicks(), SDL_GetPerformanceCounter());
+    u64 seed[2] = { SDL_GetTicks(), SDL_GetPerformanceCounter() };
+    if (replay_file_name)      start_playback(replay_file_name, seed);
+    else if (record_file_name) start_recording(record_file_name, seed);
+    set_seed(seed[0], seed[1]);
 
-    player = &players[0];
-    for (int player_index = 0; player_index < player_count; ++player_index)
+    build_collision_map();
+    init_bots();
+
+    local_player = add_player();
+    while (player_count < minimum_players)
     {
-        Player * p = players + player_index;
-        p->sprite_index = player_index;
-        p->speed = 1.0f;
-        p->angle = random_f32_range(-PI, PI);
-        p->walk = 0.0f;
-        p->walk_acceleration = 0.0f;
-        p->strafe = 0.0f;
-        p->strafe_acceleration = 0.0f;
-        randomly_spawn_player(p);
+        add_bot(add_player());
     }
 
+    swarm_match_count = hosted_matches;
+    if (swarm_size > 0)      start_swarm(max(host_port, 0));
+    else if (host_port >= 0) create_network(host_port);
+    if (hosted_matches > 1)  start_matches(max(host_port, 0), hosted_matches);
+
+    f32 accumulated_time = 0.0f;
+
     while (true)
     {
         f32 delta_time = (SDL_GetPerformanceCounter() - previous_counter_ticks) / counter_ticks_per_second;
         previous_counter_ticks = SDL_GetPerformanceCounter();
+        accumulated_time += min(delta_time, MAX_FRAME_TIME);
 
         SDL_Event event;
-        while (SDL_PollEvent(&event))
+        while (!headless && SDL_PollEvent(&event))
         {
+            // During playback, all input comes from the replay.
+            if (replay_playing && event.type != SDL_QUIT) continue;
+
             if (event.type == SDL_KEYUP || event.type == SDL_KEYDOWN)
             {
                 u32 scancode = event.key.keysym.scancode;
@@ -255,6 +588,7 @@ int main(int argument_count, char ** arguments)
                 }
                 else if (!entry_active && scancode == SDL_SCANCODE_SPACE)
                 {
+                    record_replay_shoot();
                     shoot();
                 }
                 else if (scancode == SDL_SCANCODE_F11 && pressed)
@@ -301,6 +635,7 @@ int main(int argument_count, char ** arguments)
             }
             else if (event.type == SDL_MOUSEBUTTONDOWN)
             {
+                record_replay_shoot();
                 shoot();
             }
             else if (event.type == SDL_TEXTINPUT)
@@ -318,31 +653,56 @@ int main(int argument_count, char ** arguments)
 
         handle_network();
 
-        player->walk_acceleration   = 0.0f;
-        player->strafe_acceleration = 0.0f;
-        f32 speed = player->speed * delta_time;
-        if (pressing_up)    player->walk_acceleration += speed;
-        if (pressing_down)  player->walk_acceleration -= speed;
-        if (pressing_left)  player->strafe_acceleration -= speed;
-        if (pressing_right) player->strafe_acceleration += speed;
+        if (replay_playing)
+        {
+            // Play back a frame's worth of ticks at a time when there is a
+            // window to keep drawing, otherwise everything at once.
+            play_replay(headless ? INT_MAX : TICK_RATE);
+            accumulated_time = 0.0f;
+        }
+
+        while (accumulated_time >= TICK_DURATION)
+        {
+            u64 tick_start = SDL_GetPerformanceCounter();
+            record_replay_tick();
+            simulate_tick();
+            send_network_tick();
+            f64 tick_seconds = (SDL_GetPerformanceCounter() - tick_start) / counter_ticks_per_second;
+            record_match_tick(tick_seconds);
+            if (swarm_running) record_server_tick(tick_seconds);
+            accumulated_time -= TICK_DURATION;
+        }
+
+        update_swarm();
+
+        if (headless)
+        {
+            SDL_Delay(1);
+            continue;
+        }
 
+        // Draw the world part way between the last two ticks.
+        f32 alpha = accumulated_time / TICK_DURATION;
         for (int i = 0; i < player_count; ++i)
         {
-            update_player_position(players + i, delta_time);
+            interpolated_players[i] = interpolate_player(i, alpha);
         }
+        if (network_mode == NETMODE_CLIENT) sample_remote_players(interpolated_players);
+        Player * view = interpolated_players + local_player;
 
         render_background();
-        render_player_view(player);
-        render_players();
+        render_player_view(view);
+        render_players(interpolated_players, view);
 
         for (int i = 0; i < screen_width * screen_height; ++i)
         {
-            u32 random_colour = random_int_range(-5, 5);
+            u32 random_colour = (int)(random_u64_from(noise_seed) % 11) - 5;
             random_colour = rgba(random_colour, random_colour, random_colour, 255);
             screen_pixels[i] += random_colour;
         }
 
         draw_crosshair();
+        draw_netstat_graph();
         draw_console();
         display_screen();
     }
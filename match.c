@@ -0,0 +1,136 @@
+/*
+    Labyrinth
+    Benedict Henshaw, 2018
+    match.c - Running many matches in one server process.
+*/
+
+// "--matches count" hosts count independent matches, on consecutive ports
+// starting from the one given to "--host". The first is the main thread's own,
+// the one drawn and typed into if there is a window. Every other match runs
+// headless on a worker thread of its own, with its own ENet host, players,
+// bots and clients, so a busy machine can fill all its cores from a single
+// process rather than from a process per match.
+//
+// All the state that makes up a match is MATCH_LOCAL, so each thread simply
+// has its own, and the game code neither knows nor cares which match it is
+// running. A Match holds only what other threads may look at: where the match
+// is, whether it should keep running, and a few figures it publishes every
+// tick for "/matches".
+//
+// A worker services its match's host itself between ticks, sleeping in a
+// reactor until there is a packet or the next tick is due, so it needs no
+// network thread. Workers only start once the main match is hosting, after
+// everything shared, like the map and the compression model, is ready.
+//
+// Little that is shared is written while matches run. Each match's hosts
+// compress through the same compression stats and training counts, which are
+// only ever added to atomically. The pool's allocation rates are measured by
+// the main match alone.
+
+// Called by every match after each tick.
+void record_match_tick(f64 seconds)
+{
+    if (!match) return;
+    SDL_AtomicSet(&match->client_count, client_count);
+    SDL_AtomicSet(&match->player_count, live_player_count);
+    SDL_AtomicSet(&match->tick_microseconds, seconds * 1000000.0);
+}
+
+int run_match(void * data)
+{
+    match = data;
+    // Without a window, a worker's console is only visible on stdout.
+    echo_console = true;
+    network_thread_enabled = false;
+    init_network_link();
+    set_seed(match->seed[0], match->seed[1]);
+    init_bots();
+
+    local_player = add_player();
+    while (player_count < minimum_players)
+    {
+        add_bot(add_player());
+    }
+    create_network(match->port);
+    Reactor_Host * entry = add_reactor_host(&network_link.reactor, local_host, NULL);
+
+    f64 next_tick_time = get_seconds();
+    while (SDL_AtomicGet(&match->running))
+    {
+        f64 until_tick = next_tick_time - get_seconds();
+        wait_reactor(&network_link.reactor, until_tick > 0.0 ? (u32)ceil(until_tick * 1000.0) : 0);
+        handle_network();
+
+        f64 now = get_seconds();
+        if (now >= next_tick_time)
+        {
+            simulate_tick();
+            send_network_tick();
+            // Send the tick's packets straight away, rather than on the next wake.
+            service_network(&network_link, 0);
+            record_match_tick(get_seconds() - now);
+            next_tick_time += TICK_DURATION;
+            // Do not try to catch up after falling far behind.
+            if (now - next_tick_time > MAX_FRAME_TIME) next_tick_time = now;
+        }
+        schedule_reactor_host(entry);
+    }
+
+    remove_reactor_host(&network_link.reactor, entry);
+    destroy_local_host();
+    return 0;
+}
+
+void stop_matches()
+{
+    for (int i = 1; i < match_count; ++i)
+    {
+        SDL_AtomicSet(&matches[i].running, 0);
+        SDL_WaitThread(matches[i].thread, NULL);
+    }
+    match_count = 0;
+}
+
+// Start the workers for every match past the main one, which must already be
+// hosting on the given port.
+void start_matches(int port, int count)
+{
+    port = port ? port : DEFAULT_PORT;
+    matches = calloc(count, sizeof(Match));
+    assert(matches);
+    match_count = count;
+    match = matches;
+    match->port = port;
+
+    for (int i = 1; i < count; ++i)
+    {
+        Match * worker = matches + i;
+        worker->index = i;
+        worker->port = port + i;
+        worker->seed[0] = random_u64();
+        worker->seed[1] = random_u64();
+        SDL_AtomicSet(&worker->running, 1);
+        char name[32];
+        snprintf(name, sizeof(name), "match %d", i);
+        worker->thread = SDL_CreateThread(run_match, name, worker);
+        if (!worker->thread) panic_exit("Could not start match %d.", i);
+    }
+    atexit(stop_matches);
+    push_console_string("Hosting %d matches on ports %d to %d.", count, port, port + count - 1);
+}
+
+void print_matches()
+{
+    if (match_count == 0)
+    {
+        push_console_string("Hosting a single match.");
+        return;
+    }
+    for (int i = 0; i < match_count; ++i)
+    {
+        Match * m = matches + i;
+        push_console_string("  %d port %u: %d clients, %d players, tick %.2fms", i, m->port,
+            SDL_AtomicGet(&m->client_count), SDL_AtomicGet(&m->player_count),
+            SDL_AtomicGet(&m->tick_microseconds) / 1000.0f);
+    }
+}
@@ -0,0 +1,356 @@
+/*
+    Labyrinth
+    Benedict Henshaw, 2018
+    netsim.c - Making a good connection behave like a bad one.
+*/
+
+// With a profile set, every datagram the local host sends or receives passes
+// through here on its way to or from the socket. Each one may be dropped,
+// duplicated, or held back for the profile's latency plus up to its jitter
+// before being passed on. Held datagrams keep their order, except for the
+// few picked to be reordered, which are held back further so that those
+// behind them overtake them.
+//
+// Latency applies in each direction, so a host with a profile of 50ms sees
+// round trips 100ms longer than before, whichever end of the connection is
+// simulating. Setting a profile on a server makes it apply to every client.
+//
+// All the decisions come from a generator of its own for each direction,
+// started from netsim_seed, so a run with the same seed and the same traffic
+// drops and delays the same datagrams. The game's own generator is untouched,
+// so replays are unaffected.
+//
+// Each host takes a copy of the profile when the simulator is installed, and
+// "/netsim" reinstalls it on the local host with the network thread stopped
+// after any change. "--netsim profile" sets it at startup, for every match.
+
+typedef struct
+{
+    char * name;
+    // In milliseconds, each way.
+    f32 latency;
+    f32 jitter;
+    // Chances of each datagram being affected.
+    f32 loss;
+    f32 duplicate;
+    f32 reorder;
+}
+Net_Sim_Profile;
+
+Net_Sim_Profile netsim_profiles[] =
+{
+    { "off",       0,   0,  0.0f,   0.0f,   0.0f   },
+    { "lan",       1,   1,  0.0f,   0.0f,   0.0f   },
+    { "wifi",      5,   10, 0.01f,  0.0f,   0.005f },
+    { "dsl",       20,  5,  0.005f, 0.0f,   0.0f   },
+    { "mobile",    50,  30, 0.02f,  0.005f, 0.01f  },
+    { "satellite", 300, 50, 0.01f,  0.0f,   0.0f   },
+    { "awful",     150, 80, 0.1f,   0.02f,  0.05f  },
+};
+
+Net_Sim_Profile netsim_profile = { .name = "off" };
+u64 netsim_seed = 1;
+
+typedef struct
+{
+    f64 release_time;
+    ENetAddress address;
+    u8 * data;
+    int size;
+}
+Held_Datagram;
+
+// Datagrams travelling one way, in a heap with the next to be released first.
+typedef struct
+{
+    Held_Datagram * held;
+    int count;
+    int capacity;
+    f64 last_release_time;
+    u64 random_seed[2];
+    u64 delayed;
+    u64 dropped;
+    u64 duplicated;
+    u64 reordered;
+}
+Sim_Direction;
+
+typedef struct
+{
+    // A copy of netsim_profile, as the host may be serviced on another thread.
+    Net_Sim_Profile profile;
+    Sim_Direction outgoing;
+    Sim_Direction incoming;
+}
+Net_Sim;
+
+bool netsim_active()
+{
+    return netsim_profile.latency > 0.0f || netsim_profile.jitter > 0.0f || netsim_profile.loss > 0.0f ||
+           netsim_profile.duplicate > 0.0f || netsim_profile.reorder > 0.0f;
+}
+
+f32 netsim_random(Sim_Direction * direction)
+{
+    return (f32)random_u64_from(direction->random_seed) / (f32)UINT64_MAX;
+}
+
+void hold_datagram(Sim_Direction * direction, Held_Datagram datagram)
+{
+    if (direction->count == direction->capacity)
+    {
+        direction->capacity = max(64, direction->capacity * 2);
+        direction->held = realloc(direction->held, direction->capacity * sizeof(Held_Datagram));
+        assert(direction->held);
+    }
+    int i = direction->count++;
+    while (i > 0 && direction->held[(i - 1) / 2].release_time > datagram.release_time)
+    {
+        direction->held[i] = direction->held[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    direction->held[i] = datagram;
+}
+
+// Take out the next datagram due, if any is. Its data is the caller's to free.
+bool release_datagram(Sim_Direction * direction, f64 now, Held_Datagram * result)
+{
+    if (direction->count == 0 || direction->held[0].release_time > now) return false;
+    *result = direction->held[0];
+    Held_Datagram last = direction->held[--direction->count];
+    int i = 0;
+    while (true)
+    {
+        int child = i * 2 + 1;
+        if (child >= direction->count) break;
+        if (child + 1 < direction->count && direction->held[child + 1].release_time < direction->held[child].release_time)
+        {
+            ++child;
+        }
+        if (direction->held[child].release_time >= last.release_time) break;
+        direction->held[i] = direction->held[child];
+        i = child;
+    }
+    direction->held[i] = last;
+    return true;
+}
+
+// Decide what happens to a datagram, and hold on to whatever is left of it.
+void admit_datagram(Net_Sim * sim, Sim_Direction * direction, ENetAddress address, u8 * data, int size, f64 now)
+{
+    Net_Sim_Profile * profile = &sim->profile;
+    if (netsim_random(direction) < profile->loss)
+    {
+        ++direction->dropped;
+        return;
+    }
+    int copies = 1;
+    if (netsim_random(direction) < profile->duplicate)
+    {
+        ++direction->duplicated;
+        copies = 2;
+    }
+    for (int copy = 0; copy < copies; ++copy)
+    {
+        f64 release_time = now + (profile->latency + netsim_random(direction) * profile->jitter) / 1000.0;
+        if (netsim_random(direction) < profile->reorder)
+        {
+            ++direction->reordered;
+            release_time = max(release_time, direction->last_release_time) + (profile->jitter + 5.0) / 1000.0;
+        }
+        else
+        {
+            release_time = max(release_time, direction->last_release_time);
+            direction->last_release_time = release_time;
+        }
+        Held_Datagram datagram = { .release_time = release_time, .address = address, .size = size };
+        datagram.data = pool_allocate(size);
+        memcpy(datagram.data, data, size);
+        hold_datagram(direction, datagram);
+        ++direction->delayed;
+    }
+}
+
+void send_released_datagrams(ENetHost * host, Net_Sim * sim, f64 now)
+{
+    Held_Datagram datagram;
+    while (release_datagram(&sim->outgoing, now, &datagram))
+    {
+        ENetBuffer buffer = { .data = datagram.data, .dataLength = datagram.size };
+        enet_socket_send(host->socket, &datagram.address, &buffer, 1);
+        pool_free(datagram.data);
+    }
+}
+
+int ENET_CALLBACK netsim_send(ENetHost * host, const ENetAddress * address, const ENetBuffer * buffers, size_t buffer_count)
+{
+    Net_Sim * sim = host->socketContext;
+    f64 now = get_seconds();
+    u8 data[ENET_PROTOCOL_MAXIMUM_MTU];
+    int size = 0;
+    for (size_t i = 0; i < buffer_count; ++i)
+    {
+        memcpy(data + size, buffers[i].data, buffers[i].dataLength);
+        size += buffers[i].dataLength;
+    }
+    admit_datagram(sim, &sim->outgoing, *address, data, size, now);
+    send_released_datagrams(host, sim, now);
+    return size;
+}
+
+// Take in everything waiting on the socket, then hand over the next datagram
+// that is due. Also sends any outgoing datagrams that are due, as this is
+// called every time the host is serviced.
+int ENET_CALLBACK netsim_receive(ENetHost * host, ENetAddress * address, ENetBuffer * buffers, size_t buffer_count)
+{
+    Net_Sim * sim = host->socketContext;
+    f64 now = get_seconds();
+    send_released_datagrams(host, sim, now);
+
+    while (true)
+    {
+        u8 data[ENET_PROTOCOL_MAXIMUM_MTU];
+        ENetBuffer buffer = { .data = data, .dataLength = sizeof(data) };
+        ENetAddress from;
+        int size = enet_socket_receive(host->socket, &from, &buffer, 1);
+        if (size <= 0) break;
+        admit_datagram(sim, &sim->incoming, from, data, size, now);
+    }
+
+    Held_Datagram datagram;
+    if (!release_datagram(&sim->incoming, now, &datagram)) return 0;
+    int size = min(datagram.size, (int)buffers[0].dataLength);
+    memcpy(buffers[0].data, datagram.data, size);
+    *address = datagram.address;
+    pool_free(datagram.data);
+    return size;
+}
+
+// When a host being simulated next has a datagram to release, in seconds from
+// now, or a negative number if it has none held.
+f64 next_netsim_release(ENetHost * host)
+{
+    Net_Sim * sim = host->socketContext;
+    if (host->socketSend != netsim_send) return -1.0;
+    f64 next = -1.0;
+    if (sim->outgoing.count > 0) next = sim->outgoing.held[0].release_time;
+    if (sim->incoming.count > 0 && (next < 0.0 || sim->incoming.held[0].release_time < next))
+    {
+        next = sim->incoming.held[0].release_time;
+    }
+    return next < 0.0 ? -1.0 : max(0.0, next - get_seconds());
+}
+
+void init_sim_direction(Sim_Direction * direction, u64 stream)
+{
+    *direction = (Sim_Direction){ .random_seed = { netsim_seed, stream } };
+    for (int i = 0; i < 64; ++i) random_u64_from(direction->random_seed);
+}
+
+void install_netsim(ENetHost * host)
+{
+    if (host->socketSend == netsim_send) return;
+    Net_Sim * sim = calloc(1, sizeof(Net_Sim));
+    assert(sim);
+    sim->profile = netsim_profile;
+    init_sim_direction(&sim->outgoing, 0x6F7574);
+    init_sim_direction(&sim->incoming, 0x696E);
+    host->socketContext = sim;
+    host->socketSend = netsim_send;
+    host->socketReceive = netsim_receive;
+}
+
+// Whatever is still held is lost, as it would be on a real network.
+void remove_netsim(ENetHost * host)
+{
+    if (host->socketSend != netsim_send) return;
+    Net_Sim * sim = host->socketContext;
+    Sim_Direction * directions[] = { &sim->outgoing, &sim->incoming };
+    for (int d = 0; d < 2; ++d)
+    {
+        for (int i = 0; i < directions[d]->count; ++i) pool_free(directions[d]->held[i].data);
+        free(directions[d]->held);
+    }
+    free(sim);
+    host->socketContext = NULL;
+    host->socketSend = NULL;
+    host->socketReceive = NULL;
+}
+
+// Bring a host into line with the current profile. Only to be called by
+// whoever is servicing the host.
+void update_netsim(ENetHost * host)
+{
+    if (!host) return;
+    if (netsim_active()) install_netsim(host);
+    else                 remove_netsim(host);
+}
+
+bool set_netsim_profile(char * name)
+{
+    for (int i = 0; i < (int)(sizeof(netsim_profiles) / sizeof(netsim_profiles[0])); ++i)
+    {
+        if (strcmp(name, netsim_profiles[i].name) == 0)
+        {
+            netsim_profile = netsim_profiles[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+void print_netsim()
+{
+    push_console_string("Network simulation: %s, %.0f+%.0fms, loss %.1f%%, dup %.1f%%, reorder %.1f%%",
+        netsim_profile.name, netsim_profile.latency, netsim_profile.jitter, netsim_profile.loss * 100.0f,
+        netsim_profile.duplicate * 100.0f, netsim_profile.reorder * 100.0f);
+    if (!local_host || local_host->socketSend != netsim_send) return;
+    Net_Sim * sim = local_host->socketContext;
+    Sim_Direction * directions[] = { &sim->outgoing, &sim->incoming };
+    char * names[] = { "  Out", "  In" };
+    for (int d = 0; d < 2; ++d)
+    {
+        push_console_string("%s: %llu delayed, %llu dropped, %llu duplicated, %llu reordered", names[d],
+            (unsigned long long)directions[d]->delayed, (unsigned long long)directions[d]->dropped,
+            (unsigned long long)directions[d]->duplicated, (unsigned long long)directions[d]->reordered);
+    }
+}
+
+// Console command: "/netsim" followed by a profile's name, "seed n", or
+// "set latency|jitter|loss|duplicate|reorder value", or nothing to show the
+// current settings. Chances are given as percentages.
+void netsim_command(char * argument)
+{
+    if (argument)
+    {
+        char key[32];
+        f32 value;
+        u64 seed;
+        if (sscanf(argument, "seed %llu", (unsigned long long *)&seed) == 1)
+        {
+            netsim_seed = seed;
+        }
+        else if (sscanf(argument, "set %31s %f", key, &value) == 2)
+        {
+            netsim_profile.name = "custom";
+            if      (strcmp(key, "latency") == 0)   netsim_profile.latency = max(0.0f, value);
+            else if (strcmp(key, "jitter") == 0)    netsim_profile.jitter = max(0.0f, value);
+            else if (strcmp(key, "loss") == 0)      netsim_profile.loss = clamp(0.0f, value / 100.0f, 1.0f);
+            else if (strcmp(key, "duplicate") == 0) netsim_profile.duplicate = clamp(0.0f, value / 100.0f, 1.0f);
+            else if (strcmp(key, "reorder") == 0)   netsim_profile.reorder = clamp(0.0f, value / 100.0f, 1.0f);
+            else push_console_string("Unknown setting '%s'.", key);
+        }
+        else if (!set_netsim_profile(argument))
+        {
+            push_console_string("Profiles: off lan wifi dsl mobile satellite awful");
+            return;
+        }
+
+        // A new seed or profile starts the simulation afresh.
+        stop_network_thread();
+        if (local_host) remove_netsim(local_host);
+        update_netsim(local_host);
+        start_network_thread();
+    }
+    print_netsim();
+}
@@ -0,0 +1,362 @@
+/*
+    Labyrinth
+    Benedict Henshaw, 2018
+    netstat.c - Watching how each connection is doing.
+*/
+
+// Every tick, each peer's telemetry takes a sample of what ENet makes of the
+// connection: round trip time and its variance, packet loss, and how far it is
+// throttling unreliable packets. Alongside go running totals of the bytes and
+// messages exchanged with the peer, counted by its outbox on the way out and
+// by handle_network on the way in. The last NETSTAT_HISTORY samples are kept.
+//
+// ENet's figures are read here while the network thread may be updating them.
+// Each is a single word and only ever displayed, so at worst a sample shows a
+// figure from a moment earlier.
+//
+// The host itself counts the system calls it makes to send and receive. On
+// Linux a host with more than one peer moves many datagrams with each, so the
+// datagrams per call show how much batching is saving.
+//
+// "/netstat" prints the latest figures, "/netstat graph" draws them in the
+// corner of the screen, and "/netstat dump file" appends a line per peer to a
+// file every second until "/netstat dump off".
+
+#define NETSTAT_GRAPH_HEIGHT 48
+// Peers shown by "/netstat" on a server, worst round trip first.
+#define NETSTAT_LISTED_CLIENTS 3
+
+typedef struct
+{
+    f32 bytes_sent;
+    f32 bytes_received;
+    f32 messages_sent;
+    f32 messages_received;
+}
+Net_Rates;
+
+// The server's connection, when this is a client.
+MATCH_LOCAL Peer_Telemetry server_telemetry;
+
+bool netstat_graph_visible = false;
+// On a server, the player whose client is graphed, or -1 for the first client.
+int netstat_graph_player = -1;
+
+MATCH_LOCAL FILE * netstat_dump_file;
+MATCH_LOCAL int netstat_dump_interval = TICK_RATE;
+
+void sample_telemetry(Peer_Telemetry * telemetry, ENetPeer * peer, Outbox * outbox)
+{
+    telemetry->newest = (telemetry->newest + 1) % NETSTAT_HISTORY;
+    telemetry->count = min(telemetry->count + 1, NETSTAT_HISTORY);
+    telemetry->samples[telemetry->newest] = (Net_Sample){
+        .round_trip_time     = peer->roundTripTime,
+        .round_trip_variance = peer->roundTripTimeVariance,
+        .packet_loss         = (f32)peer->packetLoss / ENET_PEER_PACKET_LOSS_SCALE,
+        .throttle            = (f32)peer->packetThrottle / ENET_PEER_PACKET_THROTTLE_SCALE,
+        .bytes_sent          = outbox->bytes_sent,
+        .bytes_received      = telemetry->bytes_received,
+        .messages_sent       = outbox->messages_sent,
+        .messages_received   = telemetry->messages_received,
+    };
+}
+
+// The sample taken age ticks before the newest.
+Net_Sample * telemetry_sample(Peer_Telemetry * telemetry, int age)
+{
+    return telemetry->samples + (telemetry->newest - age + NETSTAT_HISTORY) % NETSTAT_HISTORY;
+}
+
+// Traffic per second, over the last second of samples or as many as there are.
+Net_Rates telemetry_rates(Peer_Telemetry * telemetry)
+{
+    int span = min(telemetry->count - 1, TICK_RATE);
+    if (span <= 0) return (Net_Rates){0};
+    Net_Sample * now = telemetry_sample(telemetry, 0);
+    Net_Sample * then = telemetry_sample(telemetry, span);
+    f32 scale = (f32)TICK_RATE / span;
+    // Totals wrap around, which the unsigned differences allow for.
+    return (Net_Rates){
+        .bytes_sent        = (u32)(now->bytes_sent - then->bytes_sent) * scale,
+        .bytes_received    = (u32)(now->bytes_received - then->bytes_received) * scale,
+        .messages_sent     = (u32)(now->messages_sent - then->messages_sent) * scale,
+        .messages_received = (u32)(now->messages_received - then->messages_received) * scale,
+    };
+}
+
+Client * find_client_of_player(int player_index)
+{
+    for (int i = 0; i < client_count; ++i)
+    {
+        if (clients[i]->player_index == player_index) return clients[i];
+    }
+    return NULL;
+}
+
+void print_peer_telemetry(char * name, Peer_Telemetry * telemetry)
+{
+    if (telemetry->count == 0)
+    {
+        push_console_string("%s: no samples yet.", name);
+        return;
+    }
+    Net_Sample * sample = telemetry_sample(telemetry, 0);
+    Net_Rates rates = telemetry_rates(telemetry);
+    push_console_string("%s: rtt %.0f+-%.0fms, loss %.1f%%, throttle %.0f%%", name,
+        sample->round_trip_time, sample->round_trip_variance,
+        sample->packet_loss * 100.0f, sample->throttle * 100.0f);
+    push_console_string("  in %.1fKB/s %.0fmsg/s, out %.1fKB/s %.0fmsg/s",
+        rates.bytes_received / 1024.0f, rates.messages_received,
+        rates.bytes_sent / 1024.0f, rates.messages_sent);
+}
+
+// Since the host was created.
+void print_host_telemetry()
+{
+    if (!local_host) return;
+    push_console_string("Datagrams per call: %.1f in, %.1f out",
+        (f32)local_host->totalReceivedPackets / max(1, local_host->totalReceiveCalls),
+        (f32)local_host->totalSentPackets / max(1, local_host->totalSendCalls));
+}
+
+void print_client_telemetry(Client * client)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "Player %d", client->player_index);
+    print_peer_telemetry(name, &client->telemetry);
+}
+
+// A summary of every client, then the details of those with the worst round trips.
+void print_server_telemetry()
+{
+    if (client_count == 0)
+    {
+        push_console_string("No clients connected.");
+        return;
+    }
+
+    f32 total_round_trip = 0.0f;
+    f32 worst_loss = 0.0f;
+    for (int i = 0; i < client_count; ++i)
+    {
+        Peer_Telemetry * telemetry = &clients[i]->telemetry;
+        if (telemetry->count == 0) continue;
+        Net_Sample * sample = telemetry_sample(telemetry, 0);
+        total_round_trip += sample->round_trip_time;
+        worst_loss = max(worst_loss, sample->packet_loss);
+    }
+    push_console_string("%d clients, mean rtt %.0fms, worst loss %.1f%%",
+        client_count, total_round_trip / client_count, worst_loss * 100.0f);
+
+    Client * listed[NETSTAT_LISTED_CLIENTS] = {0};
+    for (int i = 0; i < client_count; ++i)
+    {
+        Client * client = clients[i];
+        if (client->telemetry.count == 0) continue;
+        f32 round_trip = telemetry_sample(&client->telemetry, 0)->round_trip_time;
+        // Insert into the list, keeping it in order.
+        for (int j = 0; j < NETSTAT_LISTED_CLIENTS; ++j)
+        {
+            if (!listed[j] || round_trip > telemetry_sample(&listed[j]->telemetry, 0)->round_trip_time)
+            {
+                Client * displaced = listed[j];
+                listed[j] = client;
+                client = displaced;
+                if (!client) break;
+                round_trip = telemetry_sample(&client->telemetry, 0)->round_trip_time;
+            }
+        }
+    }
+    for (int i = 0; i < NETSTAT_LISTED_CLIENTS && listed[i]; ++i)
+    {
+        print_client_telemetry(listed[i]);
+    }
+}
+
+// The telemetry to graph, and what to call it.
+Peer_Telemetry * graphed_telemetry(char ** name)
+{
+    if (network_mode == NETMODE_CLIENT && remote_server)
+    {
+        *name = "Server";
+        return &server_telemetry;
+    }
+    if (network_mode == NETMODE_SERVER && client_count > 0)
+    {
+        Client * client = netstat_graph_player == -1 ? clients[0] : find_client_of_player(netstat_graph_player);
+        if (!client) return NULL;
+        static char buffer[32];
+        snprintf(buffer, sizeof(buffer), "Player %d", client->player_index);
+        *name = buffer;
+        return &client->telemetry;
+    }
+    return NULL;
+}
+
+// Round trip time in green, bytes received each tick in blue, and packet loss
+// in red, oldest on the left. Round trips and bytes are scaled to fit, and loss
+// fills the graph at 25%.
+void draw_netstat_graph()
+{
+    if (!netstat_graph_visible) return;
+    char * name;
+    Peer_Telemetry * telemetry = graphed_telemetry(&name);
+    if (!telemetry || telemetry->count < 2) return;
+
+    int count = telemetry->count;
+    int left = screen_width - 5 - NETSTAT_HISTORY;
+    int top = 5;
+    int bottom = top + NETSTAT_GRAPH_HEIGHT;
+
+    f32 round_trip_scale = 50.0f;
+    u32 bytes_scale = 1;
+    for (int age = 0; age < count - 1; ++age)
+    {
+        Net_Sample * sample = telemetry_sample(telemetry, age);
+        round_trip_scale = max(round_trip_scale, sample->round_trip_time);
+        bytes_scale = max(bytes_scale, sample->bytes_received - telemetry_sample(telemetry, age + 1)->bytes_received);
+    }
+
+    draw_box(left - 1, top - 1, left + NETSTAT_HISTORY, bottom + 1, rgba(96, 96, 96, 255));
+
+    int previous_x = 0, previous_round_trip_y = 0, previous_bytes_y = 0, previous_loss_y = 0;
+    for (int age = count - 2; age >= 0; --age)
+    {
+        Net_Sample * sample = telemetry_sample(telemetry, age);
+        u32 bytes = sample->bytes_received - telemetry_sample(telemetry, age + 1)->bytes_received;
+        int x = left + NETSTAT_HISTORY - 1 - age;
+        int round_trip_y = bottom - (int)(sample->round_trip_time / round_trip_scale * NETSTAT_GRAPH_HEIGHT);
+        int bytes_y = bottom - (int)((f32)bytes / bytes_scale * NETSTAT_GRAPH_HEIGHT);
+        int loss_y = bottom - (int)(min(sample->packet_loss * 4.0f, 1.0f) * NETSTAT_GRAPH_HEIGHT);
+        if (age < count - 2)
+        {
+            draw_line(previous_x, previous_bytes_y, x, bytes_y, rgba(64, 96, 255, 255));
+            draw_line(previous_x, previous_loss_y, x, loss_y, rgba(255, 64, 64, 255));
+            draw_line(previous_x, previous_round_trip_y, x, round_trip_y, rgba(64, 255, 64, 255));
+        }
+        previous_x = x;
+        previous_round_trip_y = round_trip_y;
+        previous_bytes_y = bytes_y;
+        previous_loss_y = loss_y;
+    }
+
+    Net_Sample * newest = telemetry_sample(telemetry, 0);
+    Net_Rates rates = telemetry_rates(telemetry);
+    draw_text(left, bottom + 3, ~0, "%s", name);
+    draw_text(left, bottom + 3 + font_char_height, rgba(64, 255, 64, 255),
+        "rtt %.0f/%.0fms", newest->round_trip_time, round_trip_scale);
+    draw_text(left, bottom + 3 + font_char_height * 2, rgba(64, 96, 255, 255),
+        "in %.1fKB/s", rates.bytes_received / 1024.0f);
+    draw_text(left, bottom + 3 + font_char_height * 3, rgba(255, 64, 64, 255),
+        "loss %.1f%%", newest->packet_loss * 100.0f);
+}
+
+void write_telemetry_line(char * name, Peer_Telemetry * telemetry)
+{
+    if (telemetry->count == 0) return;
+    Net_Sample * sample = telemetry_sample(telemetry, 0);
+    Net_Rates rates = telemetry_rates(telemetry);
+    fprintf(netstat_dump_file, "%.3f,%s,%.0f,%.0f,%.4f,%.3f,%.0f,%.0f,%.0f,%.0f\n",
+        get_seconds(), name, sample->round_trip_time, sample->round_trip_variance,
+        sample->packet_loss, sample->throttle, rates.bytes_received, rates.bytes_sent,
+        rates.messages_received, rates.messages_sent);
+}
+
+// Called every tick, after the peers have been sampled.
+void update_netstat_dump()
+{
+    if (!netstat_dump_file || tick_count % netstat_dump_interval != 0) return;
+    if (network_mode == NETMODE_CLIENT && remote_server)
+    {
+        write_telemetry_line("server", &server_telemetry);
+    }
+    else if (network_mode == NETMODE_SERVER)
+    {
+        for (int i = 0; i < client_count; ++i)
+        {
+            char name[32];
+            snprintf(name, sizeof(name), "player %d", clients[i]->player_index);
+            write_telemetry_line(name, &clients[i]->telemetry);
+        }
+    }
+    fflush(netstat_dump_file);
+}
+
+void stop_netstat_dump()
+{
+    if (!netstat_dump_file) return;
+    fclose(netstat_dump_file);
+    netstat_dump_file = NULL;
+    push_console_string("Stopped writing network stats.");
+}
+
+// "file [seconds]" appends to file every so many seconds, "off" stops.
+void start_netstat_dump(char * argument)
+{
+    char file_name[128];
+    f32 seconds = 1.0f;
+    if (!argument || sscanf(argument, "%127s %f", file_name, &seconds) < 1)
+    {
+        push_console_string("Usage: /netstat dump file [seconds] or /netstat dump off");
+        return;
+    }
+    stop_netstat_dump();
+    if (strcmp(file_name, "off") == 0) return;
+
+    netstat_dump_file = fopen(file_name, "a");
+    if (!netstat_dump_file)
+    {
+        push_console_string("Could not open '%s'.", file_name);
+        return;
+    }
+    netstat_dump_interval = max(1, (int)(seconds * TICK_RATE));
+    fprintf(netstat_dump_file, "time,peer,rtt_ms,rtt_variance_ms,loss,throttle,"
+        "bytes_in_per_s,bytes_out_per_s,messages_in_per_s,messages_out_per_s\n");
+    push_console_string("Writing network stats to '%s' every %.1f seconds.",
+        file_name, (f32)netstat_dump_interval / TICK_RATE);
+}
+
+// Console command: "/netstat" on its own, or followed by a player's number on
+// a server, prints the figures. "graph [player]" toggles the graph, and "dump"
+// writes to a file.
+void netstat_command(char * argument)
+{
+    if (argument && strncmp(argument, "graph", 5) == 0)
+    {
+        if (argument[5] == ' ')
+        {
+            netstat_graph_player = atoi(argument + 6);
+            netstat_graph_visible = true;
+        }
+        else
+        {
+            netstat_graph_player = -1;
+            netstat_graph_visible = !netstat_graph_visible;
+        }
+        push_console_string("Network graph %s.", netstat_graph_visible ? "shown" : "hidden");
+    }
+    else if (argument && strncmp(argument, "dump", 4) == 0)
+    {
+        start_netstat_dump(argument[4] == ' ' ? argument + 5 : NULL);
+    }
+    else if (network_mode == NETMODE_CLIENT && remote_server)
+    {
+        print_host_telemetry();
+        print_peer_telemetry("Server", &server_telemetry);
+    }
+    else if (network_mode == NETMODE_SERVER && argument)
+    {
+        Client * client = find_client_of_player(atoi(argument));
+        if (client) print_client_telemetry(client);
+        else        push_console_string("Player %d has no client.", atoi(argument));
+    }
+    else if (network_mode == NETMODE_SERVER)
+    {
+        print_host_telemetry();
+        print_server_telemetry();
+    }
+    else
+    {
+        push_console_string("Not connected.");
+    }
+}
@@ -4,106 +4,677 @@
     network.c - Server and client networking.
 */
 
+// The ENet host is serviced on a thread of its own, so that packets are
+// received and acknowledged at a steady rate however long a frame takes. That
+// thread is the only one that touches the host while it runs: events reach
+// the game through incoming_messages, and the game's sends go back through
+// outgoing_messages. Each queue has exactly one producer and one consumer.
+//
+// Packets change hands along with the messages that carry them. Peers may
+// disconnect and have their slot reused before the game hears about it, so
+// messages to a peer also carry the connectID that the game knew it by.
+//
+// The thread sleeps in a reactor until the host's socket is readable, ENet
+// has a resend or ping due, or the game wakes it having queued a tick's sends,
+// so an idle server costs next to nothing.
+//
+// ENet's memory comes from the pool in pool.c, and the game's own packets are
+// built in outboxes, so sending and receiving allocate nothing once warmed up.
+//
+// Every match has its own host, queues and network thread. What the game and
+// network threads share is gathered in the match's Network_Link, which the
+// network thread is handed when it starts, having no match state of its own.
+enum
+{
+    // Network thread to game.
+    NET_CONNECT,
+    NET_DISCONNECT,
+    NET_RECEIVE,
+    // Game to network thread.
+    NET_SEND,
+    NET_DISCONNECT_PEER,
+};
+
+typedef struct
+{
+    int type;
+    int channel;
+    ENetPeer * peer;
+    u32 connect_id;
+    ENetPacket * packet;
+    ENetAddress address;
+}
+Net_Message;
+
+#define NET_QUEUE_CAPACITY 1024
+
+typedef struct
+{
+    // The host being serviced, as of when the network thread started.
+    ENetHost * host;
+    Queue incoming_messages;
+    Queue outgoing_messages;
+    Reactor reactor;
+    SDL_atomic_t running;
+}
+Network_Link;
+
+MATCH_LOCAL Network_Link network_link;
+MATCH_LOCAL SDL_Thread * network_thread;
+MATCH_LOCAL bool network_thread_enabled = true;
+// Whether the game has queued anything since it last woke the network thread.
+MATCH_LOCAL bool network_messages_pushed = false;
+
+// Messages on their way to the server, when this is a client.
+MATCH_LOCAL Outbox server_outbox;
+
 void set_player_name(char * name)
 {
     strncpy(player_name, name, sizeof(player_name));
 }
 
+// Set up the current match's side of the network. Called once by each match.
+void init_network_link()
+{
+    network_link.incoming_messages = create_queue(sizeof(Net_Message), NET_QUEUE_CAPACITY);
+    network_link.outgoing_messages = create_queue(sizeof(Net_Message), NET_QUEUE_CAPACITY);
+    init_reactor(&network_link.reactor);
+}
+
 void init_network()
 {
-    if (enet_initialize() != 0)
+    ENetCallbacks callbacks = { .malloc = pool_allocate, .free = pool_free };
+    if (enet_initialize_with_callbacks(ENET_VERSION, &callbacks) != 0)
     {
         panic_exit("Could not initialise network systems.");
     }
     atexit(enet_deinitialize);
+    init_network_link();
+}
+
+// Carry out the game's queued sends, then pass on events until there are none
+// left or the game has fallen too far behind in reading them. Called by
+// whichever thread currently owns local_host.
+void service_network(Network_Link * link, u32 timeout)
+{
+    Net_Message message;
+    while (queue_pop(&link->outgoing_messages, &message))
+    {
+        bool current = message.peer && message.peer->connectID == message.connect_id;
+        if (message.type == NET_SEND)
+        {
+            if (!current || enet_peer_send(message.peer, message.channel, message.packet) != 0)
+            {
+                enet_packet_destroy(message.packet);
+            }
+        }
+        else if (message.type == NET_DISCONNECT_PEER)
+        {
+            if (current) enet_peer_disconnect(message.peer, 0);
+        }
+    }
+
+    ENetEvent event;
+    while (!queue_is_full(&link->incoming_messages) && enet_host_service(local_host, &event, timeout) > 0)
+    {
+        message = (Net_Message){
+            .peer = event.peer,
+            .connect_id = event.peer->connectID,
+            .packet = event.packet,
+            .address = event.peer->address,
+        };
+        // Timeouts are just another way of disconnecting, as far as the game cares.
+        if (event.type == ENET_EVENT_TYPE_CONNECT)      message.type = NET_CONNECT;
+        else if (event.type == ENET_EVENT_TYPE_RECEIVE) message.type = NET_RECEIVE;
+        else                                            message.type = NET_DISCONNECT;
+        queue_push(&link->incoming_messages, &message);
+        timeout = 0;
+    }
+}
+
+int run_network_thread(void * data)
+{
+    Network_Link * link = data;
+    local_host = link->host;
+    Reactor_Host * entry = add_reactor_host(&link->reactor, local_host, NULL);
+    while (SDL_AtomicGet(&link->running))
+    {
+        if (wait_reactor(&link->reactor, REACTOR_IDLE_INTERVAL) > 0 || queue_count(&link->outgoing_messages) > 0)
+        {
+            service_network(link, 0);
+            schedule_reactor_host(entry);
+        }
+        // Leave the socket be until the game catches up.
+        if (queue_is_full(&link->incoming_messages)) SDL_Delay(1);
+    }
+    remove_reactor_host(&link->reactor, entry);
+    return 0;
+}
+
+void start_network_thread()
+{
+    if (network_thread || !network_thread_enabled || !local_host) return;
+    network_link.host = local_host;
+    SDL_AtomicSet(&network_link.running, 1);
+    network_thread = SDL_CreateThread(run_network_thread, "network", &network_link);
+    if (!network_thread)
+    {
+        // Fall back to servicing the host from handle_network.
+        SDL_AtomicSet(&network_link.running, 0);
+        push_console_string("Could not start the network thread.");
+    }
+}
+
+// Once this returns, local_host belongs to the game thread again.
+void stop_network_thread()
+{
+    if (network_thread)
+    {
+        SDL_AtomicSet(&network_link.running, 0);
+        wake_reactor(&network_link.reactor);
+        SDL_WaitThread(network_thread, NULL);
+        network_thread = NULL;
+    }
+}
+
+void toggle_network_thread()
+{
+    network_thread_enabled = !network_thread_enabled;
+    if (network_thread_enabled) start_network_thread();
+    else                        stop_network_thread();
+    push_console_string("Network thread %s.", network_thread_enabled ? "enabled" : "disabled");
+}
+
+// Have the network thread carry out whatever has been queued for it.
+void wake_network_thread()
+{
+    if (network_thread && network_messages_pushed) wake_reactor(&network_link.reactor);
+    network_messages_pushed = false;
+}
+
+// Hand a message to whoever is servicing the host. The network thread is not
+// woken for each one; the game wakes it after queueing a tick's worth.
+void push_network_message(Net_Message * message)
+{
+    while (!queue_push(&network_link.outgoing_messages, message))
+    {
+        if (network_thread)
+        {
+            wake_reactor(&network_link.reactor);
+            SDL_Delay(1);
+        }
+        else
+        {
+            service_network(&network_link, 0);
+        }
+    }
+    network_messages_pushed = true;
+}
+
+void send_packet(ENetPeer * peer, u32 connect_id, int channel, ENetPacket * packet)
+{
+    push_network_message(&(Net_Message){
+        .type = NET_SEND, .channel = channel, .peer = peer, .connect_id = connect_id, .packet = packet,
+    });
+}
+
+// Throw away everything in flight, before the host they refer to goes away.
+void discard_network_messages()
+{
+    Net_Message message;
+    while (queue_pop(&network_link.incoming_messages, &message) || queue_pop(&network_link.outgoing_messages, &message))
+    {
+        if (message.packet) enet_packet_destroy(message.packet);
+    }
+}
+
+// Hand a departed client's player back to a bot, unless there are enough
+// players without it.
+void release_player(int player_index)
+{
+    if (live_player_count > minimum_players) remove_player(player_index);
+    else                                     add_bot(player_index);
+}
+
+void destroy_local_host()
+{
+    stop_network_thread();
+    discard_network_messages();
+    while (client_count > 0)
+    {
+        Client * client = clients[client_count - 1];
+        client->peer->data = NULL;
+        release_player(client->player_index);
+        remove_client(client);
+    }
+    reset_outbox(&server_outbox, NULL, 0);
+    if (local_host)
+    {
+        remove_netsim(local_host);
+        enet_host_destroy(local_host);
+    }
+    local_host = NULL;
+    remote_server = NULL;
+}
+
+// Joining a server happens in the background over several frames, advanced by
+// handle_network: the host name is resolved on its own thread, then ENet is
+// left to connect while the game keeps running, until either the server
+// answers or CONNECT_TIMEOUT milliseconds have passed.
+enum
+{
+    CONNECTION_IDLE,
+    CONNECTION_RESOLVING,
+    CONNECTION_CONNECTING,
+    CONNECTION_CONNECTED,
+};
+
+#define CONNECT_TIMEOUT 5000
+
+enum
+{
+    RESOLVE_PENDING,
+    RESOLVE_SUCCEEDED,
+    RESOLVE_FAILED,
+    RESOLVE_ABANDONED,
+};
+
+// Shared between the game and a resolver thread. Whichever side gives it up
+// last frees it, which is decided by who changes state from RESOLVE_PENDING.
+typedef struct
+{
+    char host_name[128];
+    ENetAddress address;
+    SDL_atomic_t state;
+}
+Resolve_Request;
+
+MATCH_LOCAL int connection_state = CONNECTION_IDLE;
+MATCH_LOCAL u32 connection_start_time;
+MATCH_LOCAL char connection_name[128];
+MATCH_LOCAL Resolve_Request * resolve_request;
+
+MATCH_LOCAL u32 remote_server_id;
+
+char * format_address(ENetAddress * address)
+{
+    static _Thread_local char buffer[64];
+    if (enet_address_get_host_ip(address, buffer, sizeof(buffer)) != 0)
+    {
+        snprintf(buffer, sizeof(buffer), "unknown");
+    }
+    // IPv4 addresses are mapped into IPv6, which is noise for the player.
+    char * name = strncmp(buffer, "::ffff:", 7) == 0 ? buffer + 7 : buffer;
+    static _Thread_local char result[80];
+    snprintf(result, sizeof(result), "%s:%u", name, address->port);
+    return result;
+}
+
+int resolve_host_name(void * data)
+{
+    Resolve_Request * request = data;
+    bool resolved = enet_address_set_host(&request->address, request->host_name) == 0;
+    if (!SDL_AtomicCAS(&request->state, RESOLVE_PENDING,
+        resolved ? RESOLVE_SUCCEEDED : RESOLVE_FAILED))
+    {
+        // The game stopped waiting for this request.
+        free(request);
+    }
+    return 0;
+}
+
+void abandon_connection()
+{
+    if (resolve_request && !SDL_AtomicCAS(&resolve_request->state, RESOLVE_PENDING, RESOLVE_ABANDONED))
+    {
+        // The resolver already finished, so nobody else will free it.
+        free(resolve_request);
+    }
+    resolve_request = NULL;
+    if (remote_server)
+    {
+        stop_network_thread();
+        enet_peer_reset(remote_server);
+        start_network_thread();
+    }
+    remote_server = NULL;
+    reset_outbox(&server_outbox, NULL, 0);
+    connection_state = CONNECTION_IDLE;
 }
 
 void create_network(int port)
 {
+    abandon_connection();
     if (!port) port = DEFAULT_PORT;
     ENetAddress address = { .host = ENET_HOST_ANY, .port = port };
-    if (local_host) enet_host_destroy(local_host);
-    local_host = enet_host_create(&address, max_players, 2, 0, 0);
+    destroy_local_host();
+    local_host = enet_host_create(&address, max_players, CHANNEL_COUNT, 0, server_bandwidth);
     if (local_host == NULL) panic_exit("Could not create server at port '%d'.", port);
+    install_compressor(local_host);
+    update_netsim(local_host);
     push_console_string("Server launched.");
 
     network_mode = NETMODE_SERVER;
+    start_network_thread();
 }
 
+// Start joining a server given as "host", "host:port" or "[ipv6]:port".
 void join_network(char * address_with_optional_port)
 {
-    if (local_host) enet_host_destroy(local_host);
-    local_host = enet_host_create(NULL, 1, 2, 0, 0);
-    if (local_host == NULL) panic_exit("Could not create network client.");
+    abandon_connection();
+    destroy_local_host();
+    network_mode = 0;
 
-    ENetAddress address;
-    enet_address_set_host(&address, "localhost");
-    address.port = DEFAULT_PORT;
+    Resolve_Request * request = calloc(1, sizeof(*request));
+    assert(request);
+    request->address.port = DEFAULT_PORT;
+
+    char * name = address_with_optional_port;
+    int name_length = strlen(name);
+    char * port = NULL;
+    if (name[0] == '[')
+    {
+        char * end = strchr(name, ']');
+        if (end)
+        {
+            ++name;
+            name_length = end - name;
+            if (end[1] == ':') port = end + 2;
+        }
+    }
+    else
+    {
+        // More than one colon means a bare IPv6 address with no port.
+        char * colon = strchr(name, ':');
+        if (colon && !strchr(colon + 1, ':'))
+        {
+            name_length = colon - name;
+            port = colon + 1;
+        }
+    }
 
-    remote_server = enet_host_connect(local_host, &address, 2, 0);
-    if (remote_server == NULL)
+    if (port)
     {
-        push_console_string("Could not connect to '%s'", address_with_optional_port);
+        char * end;
+        long number = strtol(port, &end, 10);
+        if (*end || number <= 0 || number > 65535)
+        {
+            push_console_string("Invalid port in '%s'.", address_with_optional_port);
+            free(request);
+            return;
+        }
+        request->address.port = number;
+    }
+
+    snprintf(request->host_name, sizeof(request->host_name), "%.*s", name_length, name);
+    snprintf(connection_name, sizeof(connection_name), "%s", address_with_optional_port);
+
+    SDL_Thread * thread = SDL_CreateThread(resolve_host_name, "resolve", request);
+    if (!thread)
+    {
+        push_console_string("Could not start resolving '%s'.", request->host_name);
+        free(request);
         return;
     }
+    SDL_DetachThread(thread);
 
-    push_console_string("Connecting...");
-    // TODO: Is it possible to perform connections asynchronously to avoid the lag?
-    clear_entry();
-    draw_console();
-    display_screen();
+    resolve_request = request;
+    connection_state = CONNECTION_RESOLVING;
+    connection_start_time = SDL_GetTicks();
+    has_received_snapshot = false;
+    push_console_string("Resolving '%s'...", request->host_name);
+}
 
-    ENetEvent event;
-    if (enet_host_service(local_host, &event, 3000) > 0 &&
-        event.type == ENET_EVENT_TYPE_CONNECT)
+// Advance a join that is in progress.
+void update_connection()
+{
+    if (connection_state == CONNECTION_RESOLVING)
     {
-        push_console_string("Connected to '%s'", address_with_optional_port);
+        int state = SDL_AtomicGet(&resolve_request->state);
+        if (state == RESOLVE_FAILED)
+        {
+            push_console_string("Could not find '%s'.", resolve_request->host_name);
+            abandon_connection();
+        }
+        else if (state == RESOLVE_SUCCEEDED)
+        {
+            ENetAddress address = resolve_request->address;
+            abandon_connection();
+
+            local_host = enet_host_create(NULL, 1, CHANNEL_COUNT, 0, 0);
+            if (local_host == NULL) panic_exit("Could not create network client.");
+            install_compressor(local_host);
+            update_netsim(local_host);
+            remote_server = enet_host_connect(local_host, &address, CHANNEL_COUNT, 0);
+            if (remote_server == NULL)
+            {
+                push_console_string("Could not connect to '%s'.", connection_name);
+                return;
+            }
+
+            remote_server_id = remote_server->connectID;
+            reset_outbox(&server_outbox, remote_server, remote_server_id);
+            server_telemetry = (Peer_Telemetry){0};
+            network_mode = NETMODE_CLIENT;
+            connection_state = CONNECTION_CONNECTING;
+            start_network_thread();
+            push_console_string("Connecting to %s...", format_address(&address));
+        }
     }
-    else
+
+    if ((connection_state == CONNECTION_RESOLVING || connection_state == CONNECTION_CONNECTING) &&
+        SDL_GetTicks() - connection_start_time > CONNECT_TIMEOUT)
     {
-        enet_peer_reset(remote_server);
-        remote_server = NULL;
-        push_console_string("Connection failed.");
+        push_console_string("Timed out joining '%s'.", connection_name);
+        abandon_connection();
+    }
+}
+
+// Give a newly connected client control of a player that a bot was driving,
+// or of a new player if there are no bots left.
+void accept_client(ENetPeer * peer, u32 connect_id)
+{
+    int player_index = bot_count > 0 ? bot_players[bot_count - 1] : add_player();
+    if (player_index == -1)
+    {
+        push_console_string("No room for another player.");
+        push_network_message(&(Net_Message){
+            .type = NET_DISCONNECT_PEER, .peer = peer, .connect_id = connect_id,
+        });
+        return;
     }
 
-    network_mode = NETMODE_CLIENT;
+    // The player stands still until the client's first input arrives.
+    remove_bot(player_index);
+    apply_player_input(player_index, (Player_Input){ .angle = players.angle[player_index] });
+    Client * client = add_client(peer, connect_id, player_index);
+    // ENet never touches peer->data after creating the host, so it is the
+    // game's to use even while the network thread is running.
+    peer->data = client;
+
+    u8 message[3] = { MESSAGE_WELCOME, player_index, player_index >> 8 };
+    queue_message(&client->outbox, CHANNEL_RELIABLE, message, sizeof(message));
+}
+
+void handle_message(ENetPeer * peer, u8 * data, int size)
+{
+    if (size < 1) return;
+    Client * client = peer->data;
+
+    if (data[0] == MESSAGE_CHAT)
+    {
+        push_console_string("%.*s", size - 1, (char *)data + 1);
+    }
+    else if (data[0] == MESSAGE_WELCOME && network_mode == NETMODE_CLIENT && size >= 3)
+    {
+        // Every other player is now driven by the server.
+        local_player = data[1] | data[2] << 8;
+        set_player_count(local_player + 1);
+        for (int i = 0; i < player_count; ++i)
+        {
+            remove_bot(i);
+            players.walk_acceleration[i] = players.strafe_acceleration[i] = 0.0f;
+        }
+        reset_prediction();
+        reset_interpolation();
+        push_console_string("Joined as player %d.", local_player);
+    }
+    else if (data[0] == MESSAGE_SNAPSHOT && network_mode == NETMODE_CLIENT)
+    {
+        if (read_snapshot(data, size))
+        {
+            reconcile_prediction();
+            record_remote_samples();
+        }
+    }
+    else if (data[0] == MESSAGE_CLIENT_INPUT && network_mode == NETMODE_SERVER && client)
+    {
+        read_client_input(client, data, size);
+    }
+    else if (data[0] == MESSAGE_SHOOT && network_mode == NETMODE_SERVER && client)
+    {
+        read_shot(client, data, size);
+    }
+    else if (data[0] == MESSAGE_KILL && network_mode == NETMODE_CLIENT)
+    {
+        read_kill(data, size);
+    }
+    else if (data[0] == MESSAGE_PING && size == 1 + sizeof(f64) && network_mode == NETMODE_SERVER && client)
+    {
+        // Sent back as it came, for the sender to time.
+        data[0] = MESSAGE_PONG;
+        queue_message(&client->outbox, CHANNEL_UNSEQUENCED, data, size);
+    }
 }
 
 void handle_network()
 {
-    if (local_host)
+    update_connection();
+
+    if (local_host && !network_thread) service_network(&network_link, 0);
+
+    Net_Message message;
+    while (queue_pop(&network_link.incoming_messages, &message))
     {
-        ENetEvent event;
-        while (enet_host_service(local_host, &event, 0))
+        ENetPeer * peer = message.peer;
+        if (message.type == NET_RECEIVE)
+        {
+            Client * client = peer->data;
+            Peer_Telemetry * telemetry = peer == remote_server ? &server_telemetry
+                                       : client ? &client->telemetry : NULL;
+            if (telemetry) telemetry->bytes_received += message.packet->dataLength;
+
+            Message_Reader reader = make_message_reader(message.packet->data, message.packet->dataLength);
+            u8 * data;
+            int size;
+            while (next_message(&reader, &data, &size))
+            {
+                if (telemetry) ++telemetry->messages_received;
+                handle_message(peer, data, size);
+            }
+            enet_packet_destroy(message.packet);
+        }
+        else if (message.type == NET_CONNECT)
         {
-            if (event.type == ENET_EVENT_TYPE_RECEIVE)
+            if (network_mode == NETMODE_SERVER)
             {
-                push_console_string((char *)event.packet->data);
-                enet_packet_destroy(event.packet);
+                push_console_string("Connection from %s.", format_address(&message.address));
+                accept_client(peer, message.connect_id);
             }
-            else if (event.type == ENET_EVENT_TYPE_CONNECT)
+            else if (peer == remote_server)
             {
-                push_console_string("Connection from %x:%u.",
-                    event.peer->address.host,
-                    event.peer->address.port);
+                push_console_string("Connected to '%s'.", connection_name);
+                connection_state = CONNECTION_CONNECTED;
             }
-            else if (event.type == ENET_EVENT_TYPE_DISCONNECT)
+        }
+        else if (message.type == NET_DISCONNECT)
+        {
+            push_console_string("Disconnection by %s.", format_address(&message.address));
+            if (peer == remote_server)
+            {
+                remote_server = NULL;
+                reset_outbox(&server_outbox, NULL, 0);
+                connection_state = CONNECTION_IDLE;
+            }
+            Client * client = peer->data;
+            if (client && client->connect_id == message.connect_id)
             {
-                push_console_string("Disconnection by %x:%u.",
-                    event.peer->address.host,
-                    event.peer->address.port);
+                release_player(client->player_index);
+                remove_client(client);
+                peer->data = NULL;
             }
         }
     }
 }
 
+// Send this tick's updates: snapshots from the server to every client, or the
+// client's inputs and acknowledgement to the server. Everything queued for each
+// peer since the last tick goes out along with them.
+void send_network_tick()
+{
+    if (network_mode == NETMODE_SERVER)
+    {
+        for (int i = 0; i < client_count; ++i)
+        {
+            Client * client = clients[i];
+            if (snapshot_due(client))
+            {
+                u8 * buffer = begin_message(&client->outbox, CHANNEL_UNRELIABLE, SNAPSHOT_MAX_SIZE);
+                int size = buffer ? write_snapshot(client, buffer, SNAPSHOT_MAX_SIZE) : 0;
+                finish_message(&client->outbox, CHANNEL_UNRELIABLE, size);
+                snapshots_sent += 1;
+                snapshot_bytes_sent += size;
+                client->rate.last_snapshot_tick = tick_count;
+            }
+            flush_outbox(&client->outbox);
+            sample_telemetry(&client->telemetry, client->peer, &client->outbox);
+            update_send_rate(client);
+        }
+    }
+    else if (network_mode == NETMODE_CLIENT && remote_server)
+    {
+        if (connection_state == CONNECTION_CONNECTED)
+        {
+            u8 * buffer = begin_message(&server_outbox, CHANNEL_UNRELIABLE, SNAPSHOT_MAX_SIZE);
+            if (buffer) finish_message(&server_outbox, CHANNEL_UNRELIABLE, write_client_input(buffer, SNAPSHOT_MAX_SIZE));
+        }
+        flush_outbox(&server_outbox);
+        sample_telemetry(&server_telemetry, remote_server, &server_outbox);
+    }
+
+    wake_network_thread();
+    update_netstat_dump();
+    // The pool is shared by every match, so only the main one measures it.
+    if (tick_count % TICK_RATE == 0 && (!match || match->index == 0)) update_allocation_rates();
+}
+
+void send_shot(f32 angle)
+{
+    if (connection_state != CONNECTION_CONNECTED) return;
+    Shot_Intent intent = {
+        .input = next_input_sequence,
+        .angle = angle,
+        .delay = min(interpolation_delay * 1000.0, 0xFFFF),
+    };
+    u8 message[8];
+    queue_message(&server_outbox, CHANNEL_RELIABLE, message, write_shot(message, sizeof(message), &intent));
+}
+
 void send_string_over_network(char * string)
 {
-    if (network_mode)
+    u8 message[console_width];
+    int length = min(strlen(string), console_width - 1);
+    message[0] = MESSAGE_CHAT;
+    memcpy(message + 1, string, length);
+    if (network_mode == NETMODE_CLIENT && remote_server)
+    {
+        queue_message(&server_outbox, CHANNEL_RELIABLE, message, length + 1);
+    }
+    else if (network_mode == NETMODE_SERVER)
     {
-        ENetPacket * packet = enet_packet_create(string, strlen(string) + 1, ENET_PACKET_FLAG_RELIABLE);
-        if (network_mode == NETMODE_CLIENT)      enet_peer_send(remote_server, 0, packet);
-        else if (network_mode == NETMODE_SERVER) enet_host_broadcast(local_host, 0, packet);
-        enet_packet_destroy(packet);
+        for (int i = 0; i < client_count; ++i)
+        {
+            queue_message(&clients[i]->outbox, CHANNEL_RELIABLE, message, length + 1);
+        }
     }
 }
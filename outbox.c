@@ -0,0 +1,295 @@
+/*
+    Labyrinth
+    Benedict Henshaw, 2018
+    outbox.c - Gathering each tick's messages to a peer into one packet.
+*/
+
+// Messages are not sent as they are made. Each is written straight into the
+// packet being built for its peer and channel, and at the end of the tick
+// every outbox is flushed, sending one packet per channel that has anything
+// in it. Packet buffers come from the pool, and ENet is told to use them as
+// they are rather than copying them, then hands them back through the
+// packet's free callback once it is done with them.
+//
+// A packet holding a single message is sent bare, so that the usual snapshot
+// or input on its own looks the same as it always has. Anything more is sent
+// as a batch:
+//
+//   u8 MESSAGE_BATCH
+//   then for each message:
+//     u16 length, then the message
+//
+// Each channel has a policy saying how ENet is to deliver its packets, and
+// in what order the outbox's channels are flushed. ENet orders each channel
+// separately, so a reliable event being resent never holds up the state
+// behind it, which travels on another channel.
+//
+// An outbox may also be given a budget of bytes for each tick. Channels are
+// flushed in order of priority until the budget is spent; after that, a
+// channel whose packets can be dropped has them dropped, as the state in them
+// will be superseded by the next tick's, while one that cannot is held back
+// for a later tick. Held packets go out regardless after OUTBOX_MAX_DEFERRAL
+// ticks, so that a budget too small for the state alone slows events down
+// rather than stopping them. The first packet of each tick is always sent.
+// "/channels" shows the policies and what the budget has cost, and changes
+// either.
+
+#define OUTBOX_PACKET_SIZE 1200
+#define BATCH_HEADER_SIZE 1
+#define BATCH_LENGTH_SIZE 2
+#define OUTBOX_MAX_DEFERRAL 4
+
+typedef struct
+{
+    char * name;
+    u32 packet_flags;
+    // Lower numbers are flushed first.
+    int priority;
+    // Whether packets over the budget are dropped, rather than held back.
+    bool droppable;
+}
+Channel_Policy;
+
+Channel_Policy channel_policies[CHANNEL_COUNT] =
+{
+    [CHANNEL_RELIABLE]    = { "events", ENET_PACKET_FLAG_RELIABLE,    1, false },
+    [CHANNEL_UNRELIABLE]  = { "state",  0,                            0, true  },
+    [CHANNEL_UNSEQUENCED] = { "loose",  ENET_PACKET_FLAG_UNSEQUENCED, 2, true  },
+};
+
+// Bytes each outbox may send per tick, or 0 for no limit.
+int outbox_byte_budget = 0;
+
+// Running totals across every outbox, for "/channels".
+MATCH_LOCAL u32 channel_packets_dropped[CHANNEL_COUNT];
+MATCH_LOCAL u32 channel_packets_deferred[CHANNEL_COUNT];
+
+typedef struct
+{
+    ENetPeer * peer;
+    u32 connect_id;
+    // The packet being built for each channel, if any.
+    u8 * packets[CHANNEL_COUNT];
+    int sizes[CHANNEL_COUNT];
+    int message_counts[CHANNEL_COUNT];
+    // Ticks for which each channel's packet has been held back.
+    int deferrals[CHANNEL_COUNT];
+    // Bytes sent so far this tick.
+    int budget_spent;
+    // Running totals of what has been sent, for netstat.c.
+    u32 bytes_sent;
+    u32 messages_sent;
+}
+Outbox;
+
+void ENET_CALLBACK release_packet_buffer(void * data)
+{
+    ENetPacket * packet = data;
+    pool_free(packet->userData);
+}
+
+// Forget anything waiting to be sent, and send from now on to the given peer.
+void reset_outbox(Outbox * outbox, ENetPeer * peer, u32 connect_id)
+{
+    for (int channel = 0; channel < CHANNEL_COUNT; ++channel)
+    {
+        pool_free(outbox->packets[channel]);
+    }
+    *outbox = (Outbox){ .peer = peer, .connect_id = connect_id };
+}
+
+void flush_outbox_channel(Outbox * outbox, int channel)
+{
+    u8 * buffer = outbox->packets[channel];
+    if (!buffer) return;
+    outbox->packets[channel] = NULL;
+    outbox->deferrals[channel] = 0;
+    if (outbox->message_counts[channel] == 0)
+    {
+        pool_free(buffer);
+        return;
+    }
+
+    u8 * data = buffer;
+    int size = outbox->sizes[channel];
+    if (outbox->message_counts[channel] == 1)
+    {
+        data += BATCH_HEADER_SIZE + BATCH_LENGTH_SIZE;
+        size -= BATCH_HEADER_SIZE + BATCH_LENGTH_SIZE;
+    }
+
+    u32 flags = ENET_PACKET_FLAG_NO_ALLOCATE | channel_policies[channel].packet_flags;
+    outbox->budget_spent += size;
+    outbox->bytes_sent += size;
+    outbox->messages_sent += outbox->message_counts[channel];
+
+    ENetPacket * packet = enet_packet_create(data, size, flags);
+    packet->userData = buffer;
+    packet->freeCallback = release_packet_buffer;
+    send_packet(outbox->peer, outbox->connect_id, channel, packet);
+}
+
+// Size of the packet a channel would send if flushed now.
+int outbox_channel_size(Outbox * outbox, int channel)
+{
+    if (!outbox->packets[channel] || outbox->message_counts[channel] == 0) return 0;
+    if (outbox->message_counts[channel] == 1) return outbox->sizes[channel] - BATCH_HEADER_SIZE - BATCH_LENGTH_SIZE;
+    return outbox->sizes[channel];
+}
+
+// Send this tick's packets, in order of priority and within the budget.
+void flush_outbox(Outbox * outbox)
+{
+    int order[CHANNEL_COUNT];
+    for (int i = 0; i < CHANNEL_COUNT; ++i)
+    {
+        int j = i;
+        while (j > 0 && channel_policies[order[j - 1]].priority > channel_policies[i].priority)
+        {
+            order[j] = order[j - 1];
+            --j;
+        }
+        order[j] = i;
+    }
+
+    for (int i = 0; i < CHANNEL_COUNT; ++i)
+    {
+        int channel = order[i];
+        int size = outbox_channel_size(outbox, channel);
+        bool over_budget = outbox_byte_budget > 0 && outbox->budget_spent > 0 &&
+                           outbox->budget_spent + size > outbox_byte_budget;
+        if (size > 0 && over_budget && channel_policies[channel].droppable)
+        {
+            pool_free(outbox->packets[channel]);
+            outbox->packets[channel] = NULL;
+            ++channel_packets_dropped[channel];
+        }
+        else if (size > 0 && over_budget && outbox->deferrals[channel] < OUTBOX_MAX_DEFERRAL)
+        {
+            ++outbox->deferrals[channel];
+            ++channel_packets_deferred[channel];
+        }
+        else
+        {
+            flush_outbox_channel(outbox, channel);
+        }
+    }
+    outbox->budget_spent = 0;
+}
+
+// Make room for a message of up to capacity bytes, and return where to write
+// it, or NULL if a message that large could never fit in a packet. The
+// message is not sent unless finish_message is called afterwards.
+u8 * begin_message(Outbox * outbox, int channel, int capacity)
+{
+    if (capacity > OUTBOX_PACKET_SIZE - BATCH_HEADER_SIZE - BATCH_LENGTH_SIZE) return NULL;
+    if (outbox->packets[channel] &&
+        outbox->sizes[channel] + BATCH_LENGTH_SIZE + capacity > OUTBOX_PACKET_SIZE)
+    {
+        flush_outbox_channel(outbox, channel);
+    }
+    if (!outbox->packets[channel])
+    {
+        outbox->packets[channel] = pool_allocate(OUTBOX_PACKET_SIZE);
+        outbox->packets[channel][0] = MESSAGE_BATCH;
+        outbox->sizes[channel] = BATCH_HEADER_SIZE;
+        outbox->message_counts[channel] = 0;
+    }
+    return outbox->packets[channel] + outbox->sizes[channel] + BATCH_LENGTH_SIZE;
+}
+
+void finish_message(Outbox * outbox, int channel, int size)
+{
+    if (size <= 0) return;
+    u8 * length = outbox->packets[channel] + outbox->sizes[channel];
+    length[0] = size & 0xFF;
+    length[1] = size >> 8;
+    outbox->sizes[channel] += BATCH_LENGTH_SIZE + size;
+    ++outbox->message_counts[channel];
+}
+
+// Returns false, sending nothing, if the message is too large for a packet.
+bool queue_message(Outbox * outbox, int channel, u8 * data, int size)
+{
+    u8 * buffer = begin_message(outbox, channel, size);
+    if (!buffer) return false;
+    memcpy(buffer, data, size);
+    finish_message(outbox, channel, size);
+    return true;
+}
+
+// Console command: "/channels budget bytes" sets the budget, 0 for none, and
+// "/channels priority name n" reorders a channel. Either way, or with nothing,
+// the policies and what the budget has cost are shown.
+void channels_command(char * argument)
+{
+    if (argument)
+    {
+        char name[16];
+        int value;
+        if (sscanf(argument, "budget %d", &value) == 1)
+        {
+            outbox_byte_budget = max(0, value);
+        }
+        else if (sscanf(argument, "priority %15s %d", name, &value) == 2)
+        {
+            int channel = 0;
+            while (channel < CHANNEL_COUNT && strcmp(name, channel_policies[channel].name) != 0) ++channel;
+            if (channel == CHANNEL_COUNT) push_console_string("No channel named '%s'.", name);
+            else                          channel_policies[channel].priority = value;
+        }
+        else
+        {
+            push_console_string("Usage: /channels [budget bytes | priority name n]");
+            return;
+        }
+    }
+
+    if (outbox_byte_budget > 0) push_console_string("Channels, within %d bytes per tick:", outbox_byte_budget);
+    else                        push_console_string("Channels, without a budget:");
+    for (int channel = 0; channel < CHANNEL_COUNT; ++channel)
+    {
+        Channel_Policy * policy = channel_policies + channel;
+        char * delivery = policy->packet_flags & ENET_PACKET_FLAG_RELIABLE    ? "reliable" :
+                          policy->packet_flags & ENET_PACKET_FLAG_UNSEQUENCED ? "unsequenced" : "sequenced";
+        push_console_string("  %d %-6s %-11s priority %d, %u dropped, %u deferred", channel, policy->name,
+            delivery, policy->priority, channel_packets_dropped[channel], channel_packets_deferred[channel]);
+    }
+}
+
+// Steps through the messages in a received packet, whether it holds one or a
+// batch.
+typedef struct
+{
+    u8 * data;
+    int size;
+    int position;
+}
+Message_Reader;
+
+Message_Reader make_message_reader(u8 * data, int size)
+{
+    Message_Reader reader = { .data = data, .size = size };
+    if (size >= 1 && data[0] == MESSAGE_BATCH) reader.position = BATCH_HEADER_SIZE;
+    else                                       reader.position = -1;
+    return reader;
+}
+
+bool next_message(Message_Reader * reader, u8 ** message, int * size)
+{
+    if (reader->position < 0)
+    {
+        // A bare message is the whole packet.
+        if (reader->position != -1) return false;
+        reader->position = -2;
+        *message = reader->data;
+        *size = reader->size;
+        return true;
+    }
+    if (reader->position + BATCH_LENGTH_SIZE > reader->size) return false;
+    u8 * length = reader->data + reader->position;
+    *size = length[0] | length[1] << 8;
+    *message = length + BATCH_LENGTH_SIZE;
+    reader->position += BATCH_LENGTH_SIZE + *size;
+    return reader->position <= reader->size;
+}
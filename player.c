@@ -5,78 +5,197 @@
                Lots of gameplay code lives here.
 */
 
+// Get a copy of a single player's state.
+Player get_player(int index)
+{
+    return (Player){
+        .x = players.x[index],
+        .y = players.y[index],
+        .walk = players.walk[index],
+        .walk_acceleration = players.walk_acceleration[index],
+        .strafe = players.strafe[index],
+        .strafe_acceleration = players.strafe_acceleration[index],
+        .angle = players.angle[index],
+        .speed = players.speed[index],
+        .sprite_index = players.sprite_index[index],
+        .hidden = players.hidden[index],
+    };
+}
+
+void set_player_angle(int index, f32 angle)
+{
+    angle -= angle >  PI ? TWO_PI : 0.0f;
+    angle += angle < -PI ? TWO_PI : 0.0f;
+    players.angle[index] = angle;
+    players.facing_x[index] = cosf(angle);
+    players.facing_y[index] = sinf(angle);
+}
+
 void update_player_angle(f32 angle_delta)
 {
-    player->angle += angle_delta;
-    player->angle -= player->angle >  PI ? TWO_PI : 0.0f;
-    player->angle += player->angle < -PI ? TWO_PI : 0.0f;
+    set_player_angle(local_player, players.angle[local_player] + angle_delta);
 }
 
-void update_player_position(Player * player, f32 delta_time)
+// Build solid_tiles from the map: 1.0 for walls and 0.0 for open tiles. Movement
+// reads this instead of map so that collisions can be resolved with arithmetic
+// rather than branches.
+void build_collision_map()
 {
+    for (int i = 0; i < map_width * map_height; ++i)
+    {
+        solid_tiles[i] = map[i] != ' ' ? 1.0f : 0.0f;
+    }
+}
+
+// Whether a position received from elsewhere lies within the map, so that a
+// player moved there can be moved on without reading past solid_tiles.
+bool position_in_map(f32 x, f32 y)
+{
+    return isfinite(x) && isfinite(y) && x >= 0.0f && y >= 0.0f && x < map_width && y < map_height;
+}
+
+// Move a single player by one tick. This is the body of the movement kernel,
+// also used on its own by clients replaying their inputs after a correction.
+// It is branch-free and calls nothing, so that it can be vectorised inline.
+static inline void move_player(int i)
+{
+    f32 damping = 0.85f;
+    // How close to a wall the player can get before a collision occurs.
+    f32 radius = MIN_DISTANCE_FROM_WALL;
+
+    f32 walk_acceleration   = players.walk_acceleration[i];
+    f32 strafe_acceleration = players.strafe_acceleration[i];
+
     // Clamp speed when moving diagonally.
-    f32 max_speed = (player->walk_acceleration   != 0.0f &&
-                     player->strafe_acceleration != 0.0f)
+    f32 max_speed = ((walk_acceleration   != 0.0f) &
+                     (strafe_acceleration != 0.0f))
                         ? 0.2f : 0.1414214f;
-    // TODO: Framerate independent acceleration and damping.
-    f32 damping = 0.85f;
-    player->walk *= damping;
-    player->walk += player->walk_acceleration;
-    player->walk = clamp(-max_speed, player->walk, max_speed);
 
-    player->strafe *= damping;
-    player->strafe += player->strafe_acceleration;
-    player->strafe = clamp(-max_speed, player->strafe, max_speed);
+    f32 walk = players.walk[i] * damping + walk_acceleration;
+    walk = clamp(-max_speed, walk, max_speed);
+    players.walk[i] = walk;
 
-    int current_tile_x = player->x;
-    int current_tile_y = player->y;
+    f32 strafe = players.strafe[i] * damping + strafe_acceleration;
+    strafe = clamp(-max_speed, strafe, max_speed);
+    players.strafe[i] = strafe;
 
-    // How close to a wall the player can get before a collision occurs.
-    f32 radius = MIN_DISTANCE_FROM_WALL;
+    f32 x = players.x[i];
+    f32 y = players.y[i];
+    int current_tile_x = x;
+    int current_tile_y = y;
+
+    // Strafing is at a right angle to the facing direction, and
+    // cos(a + pi/2) = -sin(a), sin(a + pi/2) = cos(a).
+    f32 facing_x = players.facing_x[i];
+    f32 facing_y = players.facing_y[i];
+    f32 new_x = x - strafe * facing_y + walk * facing_x;
+    f32 new_y = y + strafe * facing_x + walk * facing_y;
 
     // Calculating x and y movement separately allows one to occur while the
     // other is blocked. This allows players to slide smoothly against walls.
+    // On collision, move to the nearest non-colliding place. Positions are
+    // never negative, so truncating after adding 0.5 rounds to nearest.
 
-    f32 new_x = player->x
-        + player->strafe * cosf(player->angle + HALF_PI)
-        + player->walk   * cosf(player->angle);
+    f32 edge_x = new_x > x ? radius : -radius;
+    int new_tile_x = new_x + edge_x;
+    f32 blocked_x = solid_tiles[new_tile_x + current_tile_y * map_width];
+    f32 resolved_x = (f32)(int)(new_x + 0.5f) - edge_x;
+    players.x[i] = new_x + (resolved_x - new_x) * blocked_x;
 
-    int new_tile_x = 0;
-    if (new_x > player->x) new_tile_x = new_x + radius;
-    else                  new_tile_x = new_x - radius;
+    f32 edge_y = new_y > y ? radius : -radius;
+    int new_tile_y = new_y + edge_y;
+    f32 blocked_y = solid_tiles[current_tile_x + new_tile_y * map_width];
+    f32 resolved_y = (f32)(int)(new_y + 0.5f) - edge_y;
+    players.y[i] = new_y + (resolved_y - new_y) * blocked_y;
+}
 
-    if (map[new_tile_x + current_tile_y * map_width] == ' ')
-    {
-        player->x = new_x;
-    }
-    else
+// Move every player by one tick. Speeds and damping are per tick, so this must
+// only ever be called from simulate_tick.
+//
+// Players are processed PLAYER_BATCH_SIZE at a time, so that the compiler can
+// turn each batch into a handful of vector instructions (with AVX2, one
+// iteration per batch of eight). Padding lanes past player_count hold zeroed,
+// idle players.
+void update_player_positions()
+{
+    int batch_count = (player_count + PLAYER_BATCH_SIZE - 1) / PLAYER_BATCH_SIZE;
+    for (int batch = 0; batch < batch_count; ++batch)
     {
-        // Collision has occurred, move to the nearest non-colliding place.
-        if (new_x > player->x) player->x = roundf(new_x) - radius;
-        else                  player->x = roundf(new_x) + radius;
+        for (int lane = 0; lane < PLAYER_BATCH_SIZE; ++lane)
+        {
+            move_player(batch * PLAYER_BATCH_SIZE + lane);
+        }
     }
+}
+
+Player_Input get_local_input()
+{
+    return (Player_Input){
+        .buttons = (pressing_up    ? INPUT_UP    : 0)
+                 | (pressing_down  ? INPUT_DOWN  : 0)
+                 | (pressing_left  ? INPUT_LEFT  : 0)
+                 | (pressing_right ? INPUT_RIGHT : 0),
+        .angle = players.angle[local_player],
+    };
+}
+
+// Set how a player will move on the coming tick.
+void apply_player_input(int index, Player_Input input)
+{
+    set_player_angle(index, input.angle);
+    players.walk_acceleration[index]   = 0.0f;
+    players.strafe_acceleration[index] = 0.0f;
+    f32 speed = players.speed[index] * TICK_DURATION;
+    if (input.buttons & INPUT_UP)    players.walk_acceleration[index] += speed;
+    if (input.buttons & INPUT_DOWN)  players.walk_acceleration[index] -= speed;
+    if (input.buttons & INPUT_LEFT)  players.strafe_acceleration[index] -= speed;
+    if (input.buttons & INPUT_RIGHT) players.strafe_acceleration[index] += speed;
+}
 
-    f32 new_y = player->y
-        + player->strafe * sinf(player->angle + HALF_PI)
-        + player->walk   * sinf(player->angle);
+// Advance the simulation by exactly one tick of TICK_DURATION seconds.
+void simulate_tick()
+{
+    memcpy(players.previous_x, players.x, player_capacity * sizeof(f32));
+    memcpy(players.previous_y, players.y, player_capacity * sizeof(f32));
+
+    local_input = get_local_input();
+    apply_player_input(local_player, local_input);
+
+    update_bots();
+    apply_client_inputs();
+    resolve_shots();
+    update_player_positions();
 
-    int new_tile_y = 0;
-    if (new_y > player->y) new_tile_y = new_y + radius;
-    else                  new_tile_y = new_y - radius;
+    prediction_error_x *= PREDICTION_ERROR_DECAY;
+    prediction_error_y *= PREDICTION_ERROR_DECAY;
 
-    if (map[current_tile_x + new_tile_y * map_width] == ' ')
+    ++tick_count;
+    if (network_mode == NETMODE_SERVER) record_rewind_frame();
+}
+
+// Get a player's state part way between the previous and current tick. Angles
+// are not blended, as the local view angle is driven directly by the mouse.
+Player interpolate_player(int index, f32 alpha)
+{
+    Player result = get_player(index);
+    f32 previous_x = players.previous_x[index];
+    f32 previous_y = players.previous_y[index];
+    // Large jumps are teleports (such as respawning), which should not be smeared.
+    if (fabsf(result.x - previous_x) < 1.0f &&
+        fabsf(result.y - previous_y) < 1.0f)
     {
-        player->y = new_y;
+        result.x = previous_x + (result.x - previous_x) * alpha;
+        result.y = previous_y + (result.y - previous_y) * alpha;
     }
-    else
+    if (index == local_player)
     {
-        // Collision has occurred, move to the nearest non-colliding place.
-        if (new_y > player->y) player->y = roundf(new_y) - radius;
-        else                  player->y = roundf(new_y) + radius;
+        result.x += prediction_error_x;
+        result.y += prediction_error_y;
     }
+    return result;
 }
 
-void randomly_spawn_player(Player * p)
+void randomly_spawn_player(int index)
 {
     while (true)
     {
@@ -84,42 +203,220 @@ void randomly_spawn_player(Player * p)
         int y = random_int_range(0, map_height);
         if (map[x + y * map_width] == ' ')
         {
-            p->x = x + 0.5f;
-            p->y = y + 0.5f;
-            p->angle = random_f32_range(-PI, PI);
+            players.x[index] = x + 0.5f;
+            players.y[index] = y + 0.5f;
+            set_player_angle(index, random_f32_range(-PI, PI));
             break;
         }
     }
 }
 
-void shoot()
+// Slots freed by removed players, to be filled before any new ones are used.
+MATCH_LOCAL int * free_player_slots;
+MATCH_LOCAL int free_player_slot_count;
+// Players currently in the game, as opposed to slots ever used.
+MATCH_LOCAL int live_player_count;
+
+// Copy an array of count items into a new one of new_count, with the rest
+// zeroed. Every player array is aligned for the movement kernel.
+void * resize_player_array(void * array, int item_size, int count, int new_count)
+{
+    size_t size = ((size_t)new_count * item_size + 31) / 32 * 32;
+    u8 * result = aligned_alloc(32, size);
+    assert(result);
+    if (array) memcpy(result, array, (size_t)count * item_size);
+    memset(result + (size_t)count * item_size, 0, size - (size_t)count * item_size);
+    free(array);
+    return result;
+}
+
+// Make room for at least count players. Capacity doubles each time, so adding
+// players one by one costs a constant amount each on average. Everything else
+// kept per player is resized here too, before player_capacity is updated.
+void reserve_players(int count)
 {
-    int index_of_player_to_kill = -1;
-    f32 closest_distance = FLT_MAX;
+    if (count <= player_capacity) return;
+    int capacity = max(player_capacity, PLAYER_BATCH_SIZE);
+    while (capacity < count) capacity *= 2;
+
+    #define RESIZE(array) array = resize_player_array(array, sizeof(*array), player_capacity, capacity)
+    RESIZE(players.x);
+    RESIZE(players.y);
+    RESIZE(players.walk);
+    RESIZE(players.walk_acceleration);
+    RESIZE(players.strafe);
+    RESIZE(players.strafe_acceleration);
+    RESIZE(players.angle);
+    RESIZE(players.facing_x);
+    RESIZE(players.facing_y);
+    RESIZE(players.speed);
+    RESIZE(players.previous_x);
+    RESIZE(players.previous_y);
+    RESIZE(players.sprite_index);
+    RESIZE(players.hidden);
+    RESIZE(players.in_use);
+    RESIZE(interpolated_players);
+    RESIZE(free_player_slots);
+    #undef RESIZE
+    resize_bots(capacity);
+    resize_remote_histories(capacity);
+    resize_client_snapshots(capacity);
+    resize_rewind_history(capacity);
+    player_capacity = capacity;
+}
+
+// Put a slot back to an idle, hidden player standing still.
+void reset_player_slot(int index)
+{
+    players.x[index] = players.y[index] = 0.0f;
+    players.previous_x[index] = players.previous_y[index] = 0.0f;
+    players.walk[index] = players.walk_acceleration[index] = 0.0f;
+    players.strafe[index] = players.strafe_acceleration[index] = 0.0f;
+    set_player_angle(index, 0.0f);
+    players.speed[index] = 1.0f;
+    players.sprite_index[index] = index % PLAYER_SPRITE_COUNT;
+    players.hidden[index] = true;
+    players.in_use[index] = false;
+}
+
+// Add a player somewhere random, in the slot of one removed earlier if there
+// is one. Returns its index, or -1 if the game is full.
+int add_player()
+{
+    int index;
+    if (free_player_slot_count > 0)
+    {
+        index = free_player_slots[--free_player_slot_count];
+    }
+    else if (player_count < max_players)
+    {
+        index = player_count++;
+        reserve_players(player_count);
+    }
+    else
+    {
+        return -1;
+    }
+
+    reset_player_slot(index);
+    players.hidden[index] = false;
+    players.in_use[index] = true;
+    randomly_spawn_player(index);
+    ++live_player_count;
+    return index;
+}
+
+void remove_player(int index)
+{
+    remove_bot(index);
+    reset_player_slot(index);
+    free_player_slots[free_player_slot_count++] = index;
+    --live_player_count;
+}
+
+// Clients follow the server's numbering, so make sure every slot it mentions
+// exists. They start hidden until the server says where they are.
+void set_player_count(int count)
+{
+    reserve_players(count);
+    for (int i = player_count; i < count; ++i)
+    {
+        reset_player_slot(i);
+        players.in_use[i] = true;
+    }
+    player_count = max(player_count, count);
+}
+
+// Walk a ray from (x, y) through the tile grid one tile boundary at a time and
+// return the distance to the first solid tile, or max_distance if none is hit.
+// Unlike the renderer this never samples between tile edges, so it is exact and
+// its cost depends only on how many tiles the ray crosses.
+f32 cast_ray(f32 x, f32 y, f32 angle, f32 max_distance)
+{
+    f32 direction_x = cosf(angle);
+    f32 direction_y = sinf(angle);
+
+    int tile_x = x;
+    int tile_y = y;
+    int step_x = direction_x < 0.0f ? -1 : 1;
+    int step_y = direction_y < 0.0f ? -1 : 1;
+
+    // Distance along the ray between two vertical or two horizontal tile edges.
+    f32 delta_x = direction_x != 0.0f ? fabsf(1.0f / direction_x) : FLT_MAX;
+    f32 delta_y = direction_y != 0.0f ? fabsf(1.0f / direction_y) : FLT_MAX;
+
+    // Distance along the ray to the first vertical and horizontal tile edges.
+    f32 next_x = (direction_x < 0.0f ? x - tile_x : tile_x + 1.0f - x) * delta_x;
+    f32 next_y = (direction_y < 0.0f ? y - tile_y : tile_y + 1.0f - y) * delta_y;
+
+    f32 distance = 0.0f;
+    while (distance < max_distance)
+    {
+        if (next_x < next_y)
+        {
+            distance = next_x;
+            next_x += delta_x;
+            tile_x += step_x;
+        }
+        else
+        {
+            distance = next_y;
+            next_y += delta_y;
+            tile_y += step_y;
+        }
+
+        if (tile_x < 0 || tile_x >= map_width ||
+            tile_y < 0 || tile_y >= map_height ||
+            map[tile_x + tile_y * map_width] != ' ')
+        {
+            return min(distance, max_distance);
+        }
+    }
+    return max_distance;
+}
+
+// Resolve a shot fired by the shooter along the given angle entirely in world
+// space. The ray is walked through the grid to find the wall it stops at, then
+// every other player's circle is tested against the unobstructed part of it.
+// Returns the index of the nearest player hit, or -1 if the shot missed.
+int hitscan(int shooter, f32 angle)
+{
+    f32 origin_x = players.x[shooter];
+    f32 origin_y = players.y[shooter];
+    f32 direction_x = cosf(angle);
+    f32 direction_y = sinf(angle);
+    f32 closest_distance = cast_ray(origin_x, origin_y, angle, view_distance);
+    int hit_index = -1;
+
     for (int player_index = 0; player_index < player_count; ++player_index)
     {
-        Player * p = players + player_index;
-        if (p != player)
+        if (player_index != shooter && !players.hidden[player_index])
         {
-            f32 distance = dist2(player->x, player->y,
-                p->x, p->y);
-            f32 scale = (screen_height / sprite_size) / distance;
-            int scaled_width = sprite_size * scale;
-            int screen_x = get_screen_x(p->x, p->y, player);
-            int cx = screen_width / 2;
-            if (abs(screen_x - cx) < (scaled_width / 2) &&
-                depth_buffer[cx] > distance)
+            // Project the target onto the ray, then compare how far it lies
+            // to the side of the ray with its radius.
+            f32 offset_x = players.x[player_index] - origin_x;
+            f32 offset_y = players.y[player_index] - origin_y;
+            f32 along  = offset_x * direction_x + offset_y * direction_y;
+            f32 across = offset_x * direction_y - offset_y * direction_x;
+            f32 overlap = PLAYER_RADIUS * PLAYER_RADIUS - across * across;
+            if (along > 0.0f && overlap > 0.0f)
             {
+                // Distance to where the ray enters the player's circle.
+                f32 distance = along - sqrtf(overlap);
                 if (distance < closest_distance)
                 {
-                    index_of_player_to_kill = player_index;
+                    closest_distance = distance;
+                    hit_index = player_index;
                 }
             }
         }
     }
-    if (index_of_player_to_kill != -1)
-    {
-        // TODO: Proper player death.
-        randomly_spawn_player(players + index_of_player_to_kill);
-    }
+    return hit_index;
+}
+
+// Only the server decides what was hit, on its next tick. See combat.c.
+void shoot()
+{
+    if (network_mode == NETMODE_CLIENT) send_shot(players.angle[local_player]);
+    else                                queue_local_shot(players.angle[local_player]);
 }
@@ -0,0 +1,116 @@
+/*
+    Labyrinth
+    Benedict Henshaw, 2018
+    pool.c - Recycling the memory that packets pass through.
+*/
+
+// ENet allocates something for nearly everything it does: every packet, every
+// command queued on a peer, every acknowledgement. All of that goes through
+// pool_allocate instead of malloc. Blocks are rounded up to a power of two and,
+// once freed, kept on a list for their size to be handed out again, so after
+// the first few seconds of play the network stops asking the system for memory
+// at all. Anything bigger than the largest size goes straight to malloc.
+//
+// Blocks are allocated on one thread and freed on another as often as not, so
+// each list has a lock of its own. They are held for a handful of instructions.
+//
+// "/allocs" shows how often each happens, to check that it stays that way.
+
+#define POOL_SMALLEST_BLOCK 32
+#define POOL_SIZE_CLASSES 8
+
+// Sits in front of every block, and keeps what follows it suitably aligned.
+typedef struct
+{
+    _Alignas(16) int size_class;
+}
+Pool_Header;
+
+typedef struct Pool_Block
+{
+    struct Pool_Block * next;
+}
+Pool_Block;
+
+Pool_Block * pool_free_lists[POOL_SIZE_CLASSES];
+SDL_SpinLock pool_locks[POOL_SIZE_CLASSES];
+
+SDL_atomic_t pool_allocation_count;
+SDL_atomic_t system_allocation_count;
+SDL_atomic_t pool_bytes_held;
+
+// Counts at the start of the current second, and over the last full one.
+int previous_pool_allocations;
+int previous_system_allocations;
+int pool_allocations_per_second;
+int system_allocations_per_second;
+
+void * ENET_CALLBACK pool_allocate(size_t size)
+{
+    SDL_AtomicAdd(&pool_allocation_count, 1);
+
+    int size_class = 0;
+    while (size_class < POOL_SIZE_CLASSES && (size_t)(POOL_SMALLEST_BLOCK << size_class) < size)
+    {
+        ++size_class;
+    }
+
+    if (size_class < POOL_SIZE_CLASSES)
+    {
+        SDL_AtomicLock(pool_locks + size_class);
+        Pool_Block * block = pool_free_lists[size_class];
+        if (block) pool_free_lists[size_class] = block->next;
+        SDL_AtomicUnlock(pool_locks + size_class);
+        if (block) return block;
+
+        size = POOL_SMALLEST_BLOCK << size_class;
+        SDL_AtomicAdd(&pool_bytes_held, size);
+    }
+    else
+    {
+        size_class = -1;
+    }
+
+    SDL_AtomicAdd(&system_allocation_count, 1);
+    Pool_Header * header = malloc(sizeof(Pool_Header) + size);
+    if (!header) return NULL;
+    header->size_class = size_class;
+    return header + 1;
+}
+
+void ENET_CALLBACK pool_free(void * memory)
+{
+    if (!memory) return;
+    Pool_Header * header = (Pool_Header *)memory - 1;
+    int size_class = header->size_class;
+    if (size_class < 0)
+    {
+        free(header);
+        return;
+    }
+
+    Pool_Block * block = memory;
+    SDL_AtomicLock(pool_locks + size_class);
+    block->next = pool_free_lists[size_class];
+    pool_free_lists[size_class] = block;
+    SDL_AtomicUnlock(pool_locks + size_class);
+}
+
+// Called once a second of ticks.
+void update_allocation_rates()
+{
+    int pool_allocations = SDL_AtomicGet(&pool_allocation_count);
+    int system_allocations = SDL_AtomicGet(&system_allocation_count);
+    pool_allocations_per_second = pool_allocations - previous_pool_allocations;
+    system_allocations_per_second = system_allocations - previous_system_allocations;
+    previous_pool_allocations = pool_allocations;
+    previous_system_allocations = system_allocations;
+}
+
+void print_allocation_stats()
+{
+    push_console_string("Allocations: %d/s, %d/s from the system.",
+        pool_allocations_per_second, system_allocations_per_second);
+    push_console_string("  %d total from the system, %d KB pooled.",
+        SDL_AtomicGet(&system_allocation_count), SDL_AtomicGet(&pool_bytes_held) / 1024);
+}
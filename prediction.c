@@ -0,0 +1,220 @@
+/*
+    Labyrinth
+    Benedict Henshaw, 2018
+    prediction.c - Sending inputs to the server, and predicting their results.
+*/
+
+// Movement is decided by the server. On every tick a client sends the buttons
+// it is holding and the way it is facing, numbered in sequence, and the server
+// applies them to the client's player one tick at a time, in order.
+//
+// Rather than wait a round trip to see each input take effect, the client
+// moves its own player straight away and keeps every input it has sent. Each
+// snapshot says where the server has the player, and after which input. The
+// client puts its player there and applies every input since again. If that
+// lands somewhere other than where it had predicted, the player is moved at
+// once, but drawn offset by the difference, which fades out over a few ticks.
+//
+// Every message repeats the inputs the server has not yet confirmed, so a
+// lost packet costs nothing as long as a later one arrives.
+//
+//   u8 MESSAGE_CLIENT_INPUT
+//   1 bit has ack, [16 bits acknowledged snapshot], 16 bits newest sequence,
+//   4 bits input count, then from newest to oldest:
+//     4 bits buttons, INPUT_ANGLE_BITS angle
+
+#define INPUT_HISTORY 64
+#define INPUT_ANGLE_BITS 16
+#define INPUT_REDUNDANCY 15
+
+#define INPUT_SCHEMA(BITS, RANGED, QUANTIZED, VARINT, FLAG, EXACT) \
+    BITS(buttons, INPUT_BUTTON_BITS) \
+    QUANTIZED(angle, -PI, PI, INPUT_ANGLE_BITS)
+
+DEFINE_SCHEMA(input, Player_Input, INPUT_SCHEMA)
+
+// A client's player is never left more than this many ticks behind its
+// inputs. Any older ones that are still waiting are skipped.
+#define INPUT_MAX_DELAY 6
+
+// Corrections larger than this are teleports, such as respawning, and are
+// not smoothed out.
+#define PREDICTION_SNAP_DISTANCE 1.0f
+
+// Inputs the client has sent, indexed by sequence number.
+MATCH_LOCAL Player_Input input_history[INPUT_HISTORY];
+MATCH_LOCAL u16 next_input_sequence;
+MATCH_LOCAL int input_history_count;
+
+// The newest input the server has told us it applied.
+MATCH_LOCAL u16 confirmed_input;
+MATCH_LOCAL bool has_confirmed_input = false;
+// The input on which the local player last died. Anything the server says of
+// it as of an earlier input is from before its respawn. See combat.c.
+MATCH_LOCAL u16 respawn_input;
+MATCH_LOCAL bool has_respawn_input = false;
+
+void reset_prediction()
+{
+    input_history_count = 0;
+    has_confirmed_input = false;
+    has_authoritative_state = false;
+    has_respawn_input = false;
+    prediction_error_x = prediction_error_y = 0.0f;
+}
+
+// Encode the newest count inputs from a history indexed by sequence number,
+// along with the acknowledgement of a snapshot, if there is one.
+int write_input_message(u8 * buffer, int capacity, bool has_ack, u16 ack,
+    Player_Input * history, u16 newest, int count)
+{
+    buffer[0] = MESSAGE_CLIENT_INPUT;
+    Bit_Writer writer = make_bit_writer(buffer + 1, capacity - 1);
+    write_bool(&writer, has_ack);
+    if (has_ack) write_bits(&writer, ack, 16);
+    write_bits(&writer, newest, 16);
+    write_bits(&writer, count, bits_for_count(INPUT_REDUNDANCY + 1));
+    for (int i = 0; i < count; ++i)
+    {
+        write_input(&writer, history + (u16)(newest - i) % INPUT_HISTORY);
+    }
+    return writer.overflowed ? 0 : 1 + bit_writer_size(&writer);
+}
+
+// Number this tick's input and encode it, along with those the server has not
+// applied yet.
+int write_client_input(u8 * buffer, int capacity)
+{
+    Player_Input input = local_input;
+    input.sequence = next_input_sequence++;
+    input_history[input.sequence % INPUT_HISTORY] = input;
+    input_history_count = min(input_history_count + 1, INPUT_HISTORY);
+
+    int count = min(input_history_count, INPUT_REDUNDANCY);
+    if (has_confirmed_input)
+    {
+        u16 unapplied = input.sequence - confirmed_input;
+        count = max(1, min(unapplied, count));
+    }
+
+    return write_input_message(buffer, capacity, has_received_snapshot, latest_snapshot_sequence,
+        input_history, input.sequence, count);
+}
+
+void read_client_input(Client * client, u8 * data, int size)
+{
+    Bit_Reader reader = make_bit_reader(data + 1, size - 1);
+    bool has_ack = read_bool(&reader);
+    u16 ack = has_ack ? read_bits(&reader, 16) : 0;
+    u16 newest = read_bits(&reader, 16);
+    int count = read_bits(&reader, bits_for_count(INPUT_REDUNDANCY + 1));
+    Player_Input inputs[INPUT_REDUNDANCY + 1];
+    for (int i = 0; i < count; ++i)
+    {
+        inputs[i].sequence = newest - i;
+        read_input(&reader, inputs + i);
+    }
+    if (reader.overflowed || count < 1 || count > INPUT_REDUNDANCY) return;
+
+    if (has_ack && (!client->has_acked || sequence_newer(ack, client->acked_sequence)) &&
+        !sequence_newer(ack, client->next_sequence - 1))
+    {
+        // Snapshots passed over by an acknowledgement most likely never arrived.
+        if (client->has_acked) client->rate.snapshots_missed += (u16)(ack - client->acked_sequence) - 1;
+        ++client->rate.snapshots_acked;
+        client->acked_sequence = ack;
+        client->has_acked = true;
+    }
+
+    if (!client->has_input)
+    {
+        // Start from the oldest input the client still remembers sending.
+        client->applied_input = newest - count;
+        client->newest_input = newest;
+        client->has_input = true;
+    }
+    else if (sequence_newer(newest, client->newest_input))
+    {
+        client->newest_input = newest;
+    }
+
+    for (int i = 0; i < count; ++i)
+    {
+        if (sequence_newer(inputs[i].sequence, client->applied_input))
+        {
+            client->inputs[inputs[i].sequence % INPUT_BUFFER_SIZE] = inputs[i];
+        }
+    }
+}
+
+// Apply the next input from every client to its player, for the tick about to
+// be simulated. A client whose next input has not arrived yet carries on with
+// its last one.
+void apply_client_inputs()
+{
+    if (network_mode != NETMODE_SERVER) return;
+    for (int i = 0; i < client_count; ++i)
+    {
+        Client * client = clients[i];
+        if (!client->has_input) continue;
+
+        u16 waiting = client->newest_input - client->applied_input;
+        if (waiting == 0) continue;
+        if (waiting > INPUT_MAX_DELAY) client->applied_input = client->newest_input - INPUT_MAX_DELAY;
+
+        u16 sequence = client->applied_input + 1;
+        Player_Input * input = client->inputs + sequence % INPUT_BUFFER_SIZE;
+        if (input->sequence == sequence) apply_player_input(client->player_index, *input);
+        client->applied_input = sequence;
+    }
+}
+
+// Check the local player against the latest state from the server, by
+// starting from it and applying again every input it has not seen.
+void reconcile_prediction()
+{
+    if (!has_authoritative_state) return;
+    has_authoritative_state = false;
+    if (has_respawn_input && sequence_newer(respawn_input, authoritative_state.input)) return;
+
+    int p = local_player;
+    Authoritative_State * state = &authoritative_state;
+    confirmed_input = state->input;
+    has_confirmed_input = true;
+    f32 predicted_x = players.x[p];
+    f32 predicted_y = players.y[p];
+    f32 angle = players.angle[p];
+
+    players.x[p] = state->x;
+    players.y[p] = state->y;
+    players.walk[p] = state->walk;
+    players.strafe[p] = state->strafe;
+
+    // Anything the server is further behind than the history reaches back
+    // cannot be replayed, so its word is taken as it is.
+    u16 unapplied = (u16)(next_input_sequence - 1) - state->input;
+    if (unapplied < min(input_history_count, INPUT_HISTORY))
+    {
+        for (u16 sequence = state->input + 1; sequence != next_input_sequence; ++sequence)
+        {
+            apply_player_input(p, input_history[sequence % INPUT_HISTORY]);
+            move_player(p);
+        }
+    }
+    set_player_angle(p, angle);
+
+    f32 error_x = predicted_x - players.x[p];
+    f32 error_y = predicted_y - players.y[p];
+    if (fabsf(error_x) + fabsf(error_y) < PREDICTION_SNAP_DISTANCE)
+    {
+        prediction_error_x += error_x;
+        prediction_error_y += error_y;
+        // Shift the previous tick along too, so interpolation does not jump.
+        players.previous_x[p] -= error_x;
+        players.previous_y[p] -= error_y;
+    }
+    else
+    {
+        prediction_error_x = prediction_error_y = 0.0f;
+    }
+}
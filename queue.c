@@ -0,0 +1,61 @@
+/*
+    Labyrinth
+    Benedict Henshaw, 2018
+    queue.c - Lock-free queues for passing messages between two threads.
+*/
+
+// A ring buffer with exactly one thread pushing and exactly one thread
+// popping. Each side only ever writes its own index, so no locks are needed:
+// the producer fills a slot and then publishes it by advancing head, and the
+// consumer copies a slot out and then hands it back by advancing tail.
+// Indices count up forever and wrap, so head - tail is always the item count.
+
+typedef struct
+{
+    u8 * items;
+    int item_size;
+    int capacity;
+    SDL_atomic_t head;
+    SDL_atomic_t tail;
+}
+Queue;
+
+// Capacity must be a power of two.
+Queue create_queue(int item_size, int capacity)
+{
+    assert((capacity & (capacity - 1)) == 0);
+    Queue queue = { .item_size = item_size, .capacity = capacity };
+    queue.items = malloc(item_size * capacity);
+    assert(queue.items);
+    return queue;
+}
+
+int queue_count(Queue * queue)
+{
+    return (u32)SDL_AtomicGet(&queue->head) - (u32)SDL_AtomicGet(&queue->tail);
+}
+
+bool queue_is_full(Queue * queue)
+{
+    return queue_count(queue) >= queue->capacity;
+}
+
+// Only ever called by the producing thread.
+bool queue_push(Queue * queue, void * item)
+{
+    u32 head = SDL_AtomicGet(&queue->head);
+    if (head - (u32)SDL_AtomicGet(&queue->tail) >= (u32)queue->capacity) return false;
+    memcpy(queue->items + (head & (queue->capacity - 1)) * queue->item_size, item, queue->item_size);
+    SDL_AtomicSet(&queue->head, head + 1);
+    return true;
+}
+
+// Only ever called by the consuming thread.
+bool queue_pop(Queue * queue, void * item)
+{
+    u32 tail = SDL_AtomicGet(&queue->tail);
+    if ((u32)SDL_AtomicGet(&queue->head) == tail) return false;
+    memcpy(item, queue->items + (tail & (queue->capacity - 1)) * queue->item_size, queue->item_size);
+    SDL_AtomicSet(&queue->tail, tail + 1);
+    return true;
+}
@@ -0,0 +1,171 @@
+/*
+    Labyrinth
+    Benedict Henshaw, 2018
+    rate.c - Sending each client only as much as its connection can take.
+*/
+
+// Every client has its own snapshot rate and its own snapshot budget, which
+// caps how many players each snapshot can bring up to date. Twice a second
+// the server looks at how the client's connection is doing and adjusts both:
+//
+//   - When the connection looks congested, snapshots are sent half as often
+//     and hold half as much, down to RATE_SLOWEST_INTERVAL and RATE_MIN_BUDGET.
+//   - Once it has looked healthy for RATE_RECOVERY_PERIODS in a row, the rate
+//     and budget creep back up, a step at a time.
+//
+// A connection is congested if snapshots are being lost, if its round trip
+// has grown well past the lowest seen (packets are queueing somewhere on the
+// way), or if the client has fallen behind in acknowledging snapshots. ENet's
+// own figure for loss only counts reliable packets, and is only updated every
+// ten seconds, so loss is judged from the snapshots that the client's
+// acknowledgements skip over instead. Backing off
+// quickly and recovering slowly keeps a poor link from ever building up a
+// backlog that ends in a timeout; the player gets fewer, smaller snapshots
+// instead, which the client's interpolation smooths over.
+//
+// Rates never go past the server-wide caps: snapshot_interval ("/snaprate")
+// is the fastest any client is sent snapshots, snapshot_byte_budget the most
+// each may hold, and server_bandwidth, if set, is the most the host sends per
+// second. ENet enforces the last itself, and every client is kept within its
+// share of it. "/rate" shows each client's rate and changes the caps.
+
+#define RATE_ADJUST_TICKS (TICK_RATE / 2)
+#define RATE_SLOWEST_INTERVAL 8
+#define RATE_MIN_BUDGET 48
+#define RATE_BUDGET_STEP 16
+#define RATE_RECOVERY_PERIODS 2
+// Loss of snapshots, and round trip growth in milliseconds over twice the
+// lowest, that count as congestion.
+#define RATE_LOSS_LIMIT 0.05f
+#define RATE_QUEUE_ALLOWANCE 50.0f
+// How quickly the lowest round trip forgets, so that it can follow the
+// connection to a slower route.
+#define RATE_BASELINE_DRIFT 0.01f
+
+bool adaptive_rate = true;
+// Bytes per second, or 0 for no limit.
+int server_bandwidth = 0;
+
+bool snapshot_due(Client * client)
+{
+    return tick_count - client->rate.last_snapshot_tick >= (u64)client->rate.interval;
+}
+
+// Keep a client's rate within the server's caps, and its share of the bandwidth.
+void cap_send_rate(Send_Rate * rate)
+{
+    rate->interval = clamp(snapshot_interval, rate->interval, max(snapshot_interval, RATE_SLOWEST_INTERVAL));
+    rate->budget = clamp(RATE_MIN_BUDGET, rate->budget, max(RATE_MIN_BUDGET, snapshot_byte_budget));
+    if (server_bandwidth > 0 && client_count > 0)
+    {
+        int share = server_bandwidth / client_count;
+        while (rate->budget * TICK_RATE / rate->interval > share && rate->interval < RATE_SLOWEST_INTERVAL)
+        {
+            ++rate->interval;
+        }
+        rate->budget = clamp(RATE_MIN_BUDGET, share * rate->interval / TICK_RATE, rate->budget);
+    }
+}
+
+bool connection_congested(Client * client)
+{
+    Send_Rate * rate = &client->rate;
+    Net_Sample * sample = telemetry_sample(&client->telemetry, 0);
+    f32 round_trip = sample->round_trip_time;
+    if (rate->lowest_round_trip <= 0.0f || round_trip < rate->lowest_round_trip)
+    {
+        rate->lowest_round_trip = round_trip;
+    }
+    else
+    {
+        rate->lowest_round_trip += (round_trip - rate->lowest_round_trip) * RATE_BASELINE_DRIFT;
+    }
+
+    int counted = rate->snapshots_acked + rate->snapshots_missed;
+    f32 loss = counted > 0 ? (f32)rate->snapshots_missed / counted : 0.0f;
+    rate->snapshots_acked = rate->snapshots_missed = 0;
+
+    // Snapshots a round trip's worth behind are expected; more means acks are being lost or delayed.
+    int unacknowledged = (u16)(client->next_sequence - client->acked_sequence);
+    int expected = round_trip / (1000.0f * TICK_DURATION * rate->interval) + 2;
+    return max(loss, sample->packet_loss) > RATE_LOSS_LIMIT ||
+           round_trip > rate->lowest_round_trip * 2.0f + RATE_QUEUE_ALLOWANCE ||
+           (client->has_acked && unacknowledged > expected * 2);
+}
+
+// Called by the server for every client, every tick, once its telemetry is sampled.
+void update_send_rate(Client * client)
+{
+    Send_Rate * rate = &client->rate;
+    if (!adaptive_rate)
+    {
+        rate->interval = snapshot_interval;
+        rate->budget = snapshot_byte_budget;
+        rate->congested = false;
+        cap_send_rate(rate);
+        return;
+    }
+    if (tick_count % RATE_ADJUST_TICKS != 0 || client->telemetry.count == 0) return;
+
+    rate->congested = connection_congested(client);
+    if (rate->congested)
+    {
+        rate->interval *= 2;
+        rate->budget /= 2;
+        rate->healthy_periods = 0;
+    }
+    else if (++rate->healthy_periods >= RATE_RECOVERY_PERIODS)
+    {
+        rate->interval -= 1;
+        rate->budget += RATE_BUDGET_STEP;
+    }
+    cap_send_rate(rate);
+}
+
+// Only to be called with the network thread stopped, or from it.
+void limit_host_bandwidth()
+{
+    if (local_host && network_mode == NETMODE_SERVER) enet_host_bandwidth_limit(local_host, 0, server_bandwidth);
+}
+
+// Console command: "/rate bandwidth bytes" caps what the server sends per
+// second, 0 for no cap, "/rate budget bytes" caps each snapshot, and
+// "/rate on" or "/rate off" turns adapting to each client on or off. Either
+// way, or with nothing, each client's rate is shown.
+void rate_command(char * argument)
+{
+    if (argument)
+    {
+        int value;
+        if (sscanf(argument, "bandwidth %d", &value) == 1)
+        {
+            server_bandwidth = max(0, value);
+            stop_network_thread();
+            limit_host_bandwidth();
+            start_network_thread();
+        }
+        else if (sscanf(argument, "budget %d", &value) == 1)
+        {
+            snapshot_byte_budget = clamp(RATE_MIN_BUDGET, value, SNAPSHOT_MAX_SIZE);
+        }
+        else if (strcmp(argument, "on") == 0 || strcmp(argument, "off") == 0)
+        {
+            adaptive_rate = strcmp(argument, "on") == 0;
+        }
+        else
+        {
+            push_console_string("Usage: /rate [bandwidth bytes | budget bytes | on | off]");
+            return;
+        }
+    }
+
+    push_console_string("Snapshot rates %s, at most %.1f/s of %d bytes.", adaptive_rate ? "adapting" : "fixed",
+        (f32)TICK_RATE / snapshot_interval, snapshot_byte_budget);
+    if (server_bandwidth > 0) push_console_string("  Bandwidth cap: %.1fKB/s", server_bandwidth / 1024.0f);
+    for (int i = 0; i < min(client_count, console_line_count - 3); ++i)
+    {
+        Send_Rate * rate = &clients[i]->rate;
+        push_console_string("  Player %d: %.1f/s of %d bytes%s", clients[i]->player_index,
+            (f32)TICK_RATE / rate->interval, rate->budget, rate->congested ? ", congested" : "");
+    }
+}
@@ -0,0 +1,247 @@
+/*
+    Labyrinth
+    Benedict Henshaw, 2018
+    reactor.c - Waiting on many ENet hosts at once.
+*/
+
+// A thread that owns several hosts waits on all of them together, rather
+// than polling each in turn. The reactor watches every host's socket with
+// epoll (or poll, away from Linux), and also knows when each host next has
+// something to do without being sent anything: resending an unacknowledged
+// command, pinging a quiet peer, or noticing that one has timed out. Waiting
+// returns the hosts that have become readable or reached that time, and only
+// those need servicing. Once a host has been serviced it is rescheduled.
+//
+// Another thread can cut a wait short with wake_reactor, as the game does
+// once it has queued a tick's packets for the network thread. Wakes are
+// collapsed, so waking repeatedly between waits costs one write.
+//
+// A reactor belongs to the thread that waits on it; only wake_reactor may be
+// called from elsewhere.
+
+// The longest a host is left alone when ENet has nothing it is waiting for.
+// Matches ENet's bandwidth throttle interval.
+#define REACTOR_IDLE_INTERVAL 1000
+#define REACTOR_EVENT_BATCH 64
+
+typedef struct
+{
+    ENetHost * host;
+    void * data;
+    // enet_time_get() time at which to service the host, ready or not.
+    u32 deadline;
+    bool ready;
+    // Where the host is in the reactor's list.
+    int list_index;
+}
+Reactor_Host;
+
+typedef struct
+{
+    // The epoll instance, or -1 when falling back to poll.
+    int epoll_fd;
+    // Written to by wake_reactor, and always watched.
+    int wake_pipe[2];
+    SDL_atomic_t wake_pending;
+    Reactor_Host ** hosts;
+    int host_count;
+    int host_capacity;
+    // The hosts that the last wait found ready.
+    Reactor_Host ** ready;
+    int ready_count;
+    struct pollfd * poll_fds;
+}
+Reactor;
+
+void init_reactor(Reactor * reactor)
+{
+    *reactor = (Reactor){ .epoll_fd = -1 };
+    if (pipe(reactor->wake_pipe) != 0) panic_exit("Could not create a pipe for the reactor.");
+    fcntl(reactor->wake_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(reactor->wake_pipe[1], F_SETFL, O_NONBLOCK);
+    reactor->poll_fds = malloc(sizeof(struct pollfd));
+    assert(reactor->poll_fds);
+#ifdef __linux__
+    reactor->epoll_fd = epoll_create1(0);
+    if (reactor->epoll_fd == -1) panic_exit("Could not create the reactor.");
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = NULL };
+    epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, reactor->wake_pipe[0], &event);
+#endif
+}
+
+void destroy_reactor(Reactor * reactor)
+{
+    while (reactor->host_count > 0)
+    {
+        free(reactor->hosts[--reactor->host_count]);
+    }
+    if (reactor->epoll_fd != -1) close(reactor->epoll_fd);
+    close(reactor->wake_pipe[0]);
+    close(reactor->wake_pipe[1]);
+    free(reactor->hosts);
+    free(reactor->ready);
+    free(reactor->poll_fds);
+    *reactor = (Reactor){ .epoll_fd = -1 };
+}
+
+// Cut short the current or next wait. Safe to call from any thread.
+void wake_reactor(Reactor * reactor)
+{
+    if (SDL_AtomicCAS(&reactor->wake_pending, 0, 1))
+    {
+        u8 byte = 0;
+        if (write(reactor->wake_pipe[1], &byte, 1) != 1)
+        {
+            // The pipe is full, so the reactor is already being woken.
+        }
+    }
+}
+
+// The host is due straight away, so that whatever it was given before being
+// added is dealt with.
+Reactor_Host * add_reactor_host(Reactor * reactor, ENetHost * host, void * data)
+{
+    if (reactor->host_count == reactor->host_capacity)
+    {
+        reactor->host_capacity = max(16, reactor->host_capacity * 2);
+        reactor->hosts = realloc(reactor->hosts, reactor->host_capacity * sizeof(Reactor_Host *));
+        reactor->ready = realloc(reactor->ready, reactor->host_capacity * sizeof(Reactor_Host *));
+        reactor->poll_fds = realloc(reactor->poll_fds, (reactor->host_capacity + 1) * sizeof(struct pollfd));
+        assert(reactor->hosts && reactor->ready && reactor->poll_fds);
+    }
+
+    Reactor_Host * entry = calloc(1, sizeof(Reactor_Host));
+    assert(entry);
+    entry->host = host;
+    entry->data = data;
+    entry->deadline = enet_time_get();
+    entry->list_index = reactor->host_count;
+    reactor->hosts[reactor->host_count++] = entry;
+
+#ifdef __linux__
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = entry };
+    if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, host->socket, &event) != 0)
+    {
+        panic_exit("Could not watch a host's socket.");
+    }
+#endif
+    return entry;
+}
+
+// Not to be called between a wait and servicing the hosts it found ready.
+void remove_reactor_host(Reactor * reactor, Reactor_Host * entry)
+{
+#ifdef __linux__
+    epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, entry->host->socket, NULL);
+#endif
+    Reactor_Host * last = reactor->hosts[--reactor->host_count];
+    reactor->hosts[entry->list_index] = last;
+    last->list_index = entry->list_index;
+    free(entry);
+}
+
+// Work out when a host that has just been serviced next needs servicing.
+void schedule_reactor_host(Reactor_Host * entry)
+{
+    ENetHost * host = entry->host;
+    u32 now = enet_time_get();
+    u32 deadline = now + REACTOR_IDLE_INTERVAL;
+
+    // Events that were left undelivered are due now, as are datagrams left in
+    // the last batch received, which the socket will not say are waiting.
+    bool batch_unread = false;
+#ifdef ENET_SOCKET_BATCHING
+    batch_unread = host->receivedDatagramIndex < host->receivedDatagramCount;
+#endif
+    if (!enet_list_empty(&host->dispatchQueue) || batch_unread)
+    {
+        entry->deadline = now;
+        return;
+    }
+
+    for (ENetPeer * peer = host->peers; peer < host->peers + host->peerCount; ++peer)
+    {
+        if (peer->state == ENET_PEER_STATE_DISCONNECTED) continue;
+        if (!enet_list_empty(&peer->sentReliableCommands) && ENET_TIME_LESS(peer->nextTimeout, deadline))
+        {
+            deadline = peer->nextTimeout;
+        }
+        u32 ping_time = peer->lastReceiveTime + peer->pingInterval;
+        if (ENET_TIME_LESS(ping_time, deadline)) deadline = ping_time;
+    }
+
+    // Datagrams held back by the network simulator are due when they are released.
+    f64 release = next_netsim_release(host);
+    if (release >= 0.0 && release * 1000.0 < deadline - now) deadline = now + (u32)ceil(release * 1000.0);
+    entry->deadline = deadline;
+}
+
+void mark_reactor_host_ready(Reactor * reactor, Reactor_Host * entry)
+{
+    if (entry->ready) return;
+    entry->ready = true;
+    reactor->ready[reactor->ready_count++] = entry;
+}
+
+// Wait until a host is readable or due, or timeout milliseconds have passed,
+// or someone calls wake_reactor. Returns how many hosts are in reactor->ready.
+int wait_reactor(Reactor * reactor, u32 timeout)
+{
+    for (int i = 0; i < reactor->ready_count; ++i)
+    {
+        reactor->ready[i]->ready = false;
+    }
+    reactor->ready_count = 0;
+
+    u32 now = enet_time_get();
+    for (int i = 0; i < reactor->host_count; ++i)
+    {
+        u32 deadline = reactor->hosts[i]->deadline;
+        if (ENET_TIME_LESS_EQUAL(deadline, now)) timeout = 0;
+        else                                     timeout = min(timeout, deadline - now);
+    }
+
+    bool woken = false;
+#ifdef __linux__
+    struct epoll_event events[REACTOR_EVENT_BATCH];
+    int count = epoll_wait(reactor->epoll_fd, events, REACTOR_EVENT_BATCH, timeout);
+    for (int i = 0; i < count; ++i)
+    {
+        if (events[i].data.ptr) mark_reactor_host_ready(reactor, events[i].data.ptr);
+        else                    woken = true;
+    }
+#else
+    struct pollfd * fds = reactor->poll_fds;
+    fds[0] = (struct pollfd){ .fd = reactor->wake_pipe[0], .events = POLLIN };
+    for (int i = 0; i < reactor->host_count; ++i)
+    {
+        fds[i + 1] = (struct pollfd){ .fd = reactor->hosts[i]->host->socket, .events = POLLIN };
+    }
+    if (poll(fds, reactor->host_count + 1, timeout) > 0)
+    {
+        woken = fds[0].revents != 0;
+        for (int i = 0; i < reactor->host_count; ++i)
+        {
+            if (fds[i + 1].revents) mark_reactor_host_ready(reactor, reactor->hosts[i]);
+        }
+    }
+#endif
+
+    if (woken)
+    {
+        // Anything woken for after this is seen by whatever the caller does next.
+        SDL_AtomicSet(&reactor->wake_pending, 0);
+        u8 buffer[64];
+        while (read(reactor->wake_pipe[0], buffer, sizeof(buffer)) > 0) {}
+    }
+
+    now = enet_time_get();
+    for (int i = 0; i < reactor->host_count; ++i)
+    {
+        if (ENET_TIME_LESS_EQUAL(reactor->hosts[i]->deadline, now))
+        {
+            mark_reactor_host_ready(reactor, reactor->hosts[i]);
+        }
+    }
+    return reactor->ready_count;
+}
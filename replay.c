@@ -0,0 +1,302 @@
+/*
+    Labyrinth
+    Benedict Henshaw, 2018
+    replay.c - Recording and deterministic playback of play sessions.
+*/
+
+// The simulation is deterministic given its random seed and the local
+// player's inputs on each tick, so that is all a replay stores. A replay is a
+// header followed by a stream of records, each starting with a type byte.
+// Records are written in the order things happened relative to ticks, so
+// playing them back in order reproduces the session exactly.
+//
+// All values are stored little-endian.
+//
+//   Header:  "LBRP", u32 version, u32 tick rate, u64 seed[2]
+//   Ticks:   u8 input flags, u8 count   Run count ticks with these keys held.
+//   Angle:   f32 angle                  The local view angle changed.
+//   Shoot:                              The local player fired.
+//   Command: u8 length, length bytes    A console entry was submitted.
+//   End:     u64 state hash             Hash of the final simulation state.
+
+#define REPLAY_VERSION 1
+
+enum
+{
+    REPLAY_END,
+    REPLAY_TICKS,
+    REPLAY_ANGLE,
+    REPLAY_SHOOT,
+    REPLAY_COMMAND,
+};
+
+FILE * replay_file;
+
+// Ticks with identical inputs are gathered into a single record.
+u8 replay_run_inputs;
+int replay_run_length;
+f32 replay_recorded_angle;
+
+// Ticks played back so far, and how long playback has taken.
+u64 replay_tick_count;
+u64 replay_start_counter;
+
+void write_replay_bytes(void * data, int byte_count)
+{
+    if (fwrite(data, 1, byte_count, replay_file) != (size_t)byte_count)
+    {
+        panic_exit("Could not write to replay file.");
+    }
+}
+
+void write_replay_u8(u8 value)
+{
+    write_replay_bytes(&value, 1);
+}
+
+void write_replay_u32(u32 value)
+{
+    u8 bytes[4];
+    for (int i = 0; i < 4; ++i) bytes[i] = value >> (i * 8);
+    write_replay_bytes(bytes, 4);
+}
+
+void write_replay_u64(u64 value)
+{
+    write_replay_u32(value);
+    write_replay_u32(value >> 32);
+}
+
+void write_replay_f32(f32 value)
+{
+    u32 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    write_replay_u32(bits);
+}
+
+// Reading past the end of a replay is treated like reaching an End record.
+bool read_replay_bytes(void * data, int byte_count)
+{
+    return fread(data, 1, byte_count, replay_file) == (size_t)byte_count;
+}
+
+u8 read_replay_u8()
+{
+    u8 value = REPLAY_END;
+    read_replay_bytes(&value, 1);
+    return value;
+}
+
+u32 read_replay_u32()
+{
+    u8 bytes[4] = {0};
+    read_replay_bytes(bytes, 4);
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((u32)bytes[3] << 24);
+}
+
+u64 read_replay_u64()
+{
+    u64 low = read_replay_u32();
+    return low | ((u64)read_replay_u32() << 32);
+}
+
+f32 read_replay_f32()
+{
+    u32 bits = read_replay_u32();
+    f32 value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// FNV-1a hash of everything the simulation has produced, used to check that a
+// replay played back exactly as it was recorded.
+u64 hash_simulation_state()
+{
+    u64 hash = 14695981039346656037ull;
+    #define HASH(array) \
+        for (int i = 0; i < (int)(player_count * sizeof(*array)); ++i) \
+            hash = (hash ^ ((u8 *)array)[i]) * 1099511628211ull;
+    HASH(players.x);
+    HASH(players.y);
+    HASH(players.angle);
+    HASH(players.walk);
+    HASH(players.strafe);
+    #undef HASH
+    return hash ^ tick_count;
+}
+
+void flush_replay_ticks()
+{
+    if (replay_run_length)
+    {
+        write_replay_u8(REPLAY_TICKS);
+        write_replay_u8(replay_run_inputs);
+        write_replay_u8(replay_run_length);
+        replay_run_length = 0;
+    }
+}
+
+void finish_recording()
+{
+    if (replay_file && !replay_playing)
+    {
+        flush_replay_ticks();
+        write_replay_u8(REPLAY_END);
+        write_replay_u64(hash_simulation_state());
+        fclose(replay_file);
+        replay_file = NULL;
+    }
+}
+
+void start_recording(char * file_name, u64 seed[2])
+{
+    replay_file = fopen(file_name, "wb");
+    if (!replay_file) panic_exit("Could not create replay file '%s'.", file_name);
+
+    write_replay_bytes("LBRP", 4);
+    write_replay_u32(REPLAY_VERSION);
+    write_replay_u32(TICK_RATE);
+    write_replay_u64(seed[0]);
+    write_replay_u64(seed[1]);
+
+    replay_recorded_angle = NAN;
+    atexit(finish_recording);
+}
+
+// Open a replay for playback and read the seed it was recorded with.
+void start_playback(char * file_name, u64 seed[2])
+{
+    replay_file = fopen(file_name, "rb");
+    if (!replay_file) panic_exit("Could not open replay file '%s'.", file_name);
+
+    char magic[4] = {0};
+    read_replay_bytes(magic, 4);
+    u32 version = read_replay_u32();
+    u32 tick_rate = read_replay_u32();
+    if (memcmp(magic, "LBRP", 4) != 0 || version != REPLAY_VERSION || tick_rate != TICK_RATE)
+    {
+        panic_exit("'%s' is not a replay this version can play.", file_name);
+    }
+    seed[0] = read_replay_u64();
+    seed[1] = read_replay_u64();
+
+    replay_playing = true;
+    replay_start_counter = SDL_GetPerformanceCounter();
+}
+
+// Record the local player's view angle. Absolute angles are stored rather than
+// mouse deltas so that playback does not depend on how deltas were summed.
+void record_replay_angle()
+{
+    f32 angle = players.angle[local_player];
+    if (replay_file && !replay_playing && angle != replay_recorded_angle)
+    {
+        flush_replay_ticks();
+        write_replay_u8(REPLAY_ANGLE);
+        write_replay_f32(angle);
+        replay_recorded_angle = angle;
+    }
+}
+
+void record_replay_shoot()
+{
+    if (replay_file && !replay_playing)
+    {
+        record_replay_angle();
+        flush_replay_ticks();
+        write_replay_u8(REPLAY_SHOOT);
+    }
+}
+
+void record_replay_command(char * string)
+{
+    if (replay_file && !replay_playing)
+    {
+        record_replay_angle();
+        flush_replay_ticks();
+        int length = min(strlen(string), 255);
+        write_replay_u8(REPLAY_COMMAND);
+        write_replay_u8(length);
+        write_replay_bytes(string, length);
+    }
+}
+
+// Record the inputs held for the tick about to be simulated.
+void record_replay_tick()
+{
+    if (replay_file && !replay_playing)
+    {
+        record_replay_angle();
+        u8 inputs = get_local_input().buttons;
+        if (replay_run_length && (inputs != replay_run_inputs || replay_run_length == 255))
+        {
+            flush_replay_ticks();
+        }
+        replay_run_inputs = inputs;
+        ++replay_run_length;
+    }
+}
+
+void finish_playback(u64 recorded_hash)
+{
+    f64 seconds = (SDL_GetPerformanceCounter() - replay_start_counter)
+                / (f64)SDL_GetPerformanceFrequency();
+    bool matched = recorded_hash == hash_simulation_state();
+    push_console_string("Replay finished: %llu ticks in %.3fs (%.0f ticks/s).",
+        (unsigned long long)replay_tick_count, seconds, replay_tick_count / seconds);
+    push_console_string(matched ? "Replay matched the recording."
+                                : "Replay diverged from the recording!");
+    fclose(replay_file);
+    replay_file = NULL;
+    replay_playing = false;
+    exit(matched ? 0 : 1);
+}
+
+// Play back records until at least tick_budget ticks have been simulated, or
+// the replay ends. Ticks are simulated back to back, as fast as possible.
+void play_replay(int tick_budget)
+{
+    while (replay_playing && tick_budget > 0)
+    {
+        u8 type = read_replay_u8();
+        if (type == REPLAY_TICKS)
+        {
+            u8 inputs = read_replay_u8();
+            int count = read_replay_u8();
+            pressing_up    = inputs & INPUT_UP;
+            pressing_down  = inputs & INPUT_DOWN;
+            pressing_left  = inputs & INPUT_LEFT;
+            pressing_right = inputs & INPUT_RIGHT;
+            for (int i = 0; i < count; ++i)
+            {
+                simulate_tick();
+            }
+            replay_tick_count += count;
+            tick_budget -= count;
+        }
+        else if (type == REPLAY_ANGLE)
+        {
+            set_player_angle(local_player, read_replay_f32());
+        }
+        else if (type == REPLAY_SHOOT)
+        {
+            shoot();
+        }
+        else if (type == REPLAY_COMMAND)
+        {
+            char command[256] = {0};
+            int length = read_replay_u8();
+            read_replay_bytes(command, length);
+            clear_entry();
+            length = min(length, console_width - 1);
+            memcpy(entry, command, length);
+            entry[length] = '\0';
+            entry_index = strlen(entry);
+            submit_entry();
+        }
+        else
+        {
+            finish_playback(read_replay_u64());
+        }
+    }
+}
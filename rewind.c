@@ -0,0 +1,107 @@
+/*
+    Labyrinth
+    Benedict Henshaw, 2018
+    rewind.c - Resolving shots against the world as the shooter saw it.
+*/
+
+// A client draws other players where they were some time ago: the snapshot
+// took half a round trip to arrive, and is then held back by the client's
+// interpolation delay. By the time the client's shot reaches the server,
+// another half a round trip has passed. So a shot is judged against where its
+// targets were a round trip plus the shooter's interpolation delay ago, not
+// where they are now.
+//
+// To make that possible the server keeps where every player was at the end
+// of each of the last REWIND_HISTORY ticks. To resolve a shot, every player
+// is moved back to the time it was aimed at, blending between the ticks
+// either side, the usual hitscan is run from where the shooter is now, and
+// then everyone is put back. Each of those steps is a pass over two arrays of
+// floats, so rewinding costs next to nothing next to the hitscan itself, and
+// combat.c has shots aimed at the same moment share one rewind.
+//
+// Shots are never rewound by more than MAX_REWIND seconds, so that a very
+// slow connection cannot reach far into the past.
+
+#define REWIND_HISTORY 32
+#define MAX_REWIND 0.5
+
+typedef struct
+{
+    // Positions at the end of each tick.
+    f32 * x;
+    f32 * y;
+    int player_count;
+}
+Rewind_Frame;
+
+MATCH_LOCAL Rewind_Frame rewind_frames[REWIND_HISTORY];
+MATCH_LOCAL u64 newest_rewind_tick;
+MATCH_LOCAL int rewind_frame_count = 0;
+
+// Where everyone actually is, while rewound.
+MATCH_LOCAL f32 * unwound_x;
+MATCH_LOCAL f32 * unwound_y;
+
+void resize_rewind_history(int capacity)
+{
+    for (int i = 0; i < REWIND_HISTORY; ++i)
+    {
+        rewind_frames[i].x = resize_player_array(rewind_frames[i].x, sizeof(f32), player_capacity, capacity);
+        rewind_frames[i].y = resize_player_array(rewind_frames[i].y, sizeof(f32), player_capacity, capacity);
+    }
+    unwound_x = resize_player_array(unwound_x, sizeof(f32), player_capacity, capacity);
+    unwound_y = resize_player_array(unwound_y, sizeof(f32), player_capacity, capacity);
+}
+
+// Called by the server at the end of every tick.
+void record_rewind_frame()
+{
+    Rewind_Frame * frame = rewind_frames + tick_count % REWIND_HISTORY;
+    memcpy(frame->x, players.x, player_count * sizeof(f32));
+    memcpy(frame->y, players.y, player_count * sizeof(f32));
+    frame->player_count = player_count;
+    newest_rewind_tick = tick_count;
+    rewind_frame_count = min(rewind_frame_count + 1, REWIND_HISTORY);
+}
+
+// Move every player but the shooter, if there is one, back to where they were
+// at the given server tick, which may fall between two. Players added since
+// stay put.
+void rewind_players(int shooter, f64 tick)
+{
+    memcpy(unwound_x, players.x, player_count * sizeof(f32));
+    memcpy(unwound_y, players.y, player_count * sizeof(f32));
+    if (rewind_frame_count == 0) return;
+
+    f64 oldest_tick = newest_rewind_tick - (rewind_frame_count - 1);
+    tick = clamp(oldest_tick, tick, (f64)newest_rewind_tick);
+    u64 before_tick = (u64)tick;
+    u64 after_tick = min(before_tick + 1, newest_rewind_tick);
+    f32 alpha = tick - before_tick;
+
+    Rewind_Frame * before = rewind_frames + before_tick % REWIND_HISTORY;
+    Rewind_Frame * after = rewind_frames + after_tick % REWIND_HISTORY;
+    int count = min(before->player_count, after->player_count);
+    for (int i = 0; i < count; ++i)
+    {
+        f32 x = before->x[i] + (after->x[i] - before->x[i]) * alpha;
+        f32 y = before->y[i] + (after->y[i] - before->y[i]) * alpha;
+        // Large jumps are teleports (such as respawning), which should not be blended.
+        if (fabsf(after->x[i] - before->x[i]) >= 1.0f || fabsf(after->y[i] - before->y[i]) >= 1.0f)
+        {
+            x = alpha < 0.5f ? before->x[i] : after->x[i];
+            y = alpha < 0.5f ? before->y[i] : after->y[i];
+        }
+        players.x[i] = x;
+        players.y[i] = y;
+    }
+    if (shooter == -1) return;
+    players.x[shooter] = unwound_x[shooter];
+    players.y[shooter] = unwound_y[shooter];
+}
+
+void restore_players()
+{
+    memcpy(players.x, unwound_x, player_count * sizeof(f32));
+    memcpy(players.y, unwound_y, player_count * sizeof(f32));
+}
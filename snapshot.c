@@ -0,0 +1,494 @@
+/*
+    Labyrinth
+    Benedict Henshaw, 2018
+    snapshot.c - Replication of player state from the server to clients.
+*/
+
+// The server sends every client a snapshot of the players relevant to it on
+// each tick, over the unreliable channel. Positions are quantized to 1/256 of
+// a tile and angles to ANGLE_BITS, then each snapshot is encoded as a delta
+// against the latest snapshot that the client has acknowledged receiving: only
+// players that have changed are written, each as its index, a mask of which
+// fields changed, and then only those fields.
+//
+// Which players are relevant is decided by interest.c. A player that stops
+// being relevant is sent once more with its visible field cleared, and then
+// costs nothing until it becomes relevant again. Changed players are written
+// in order of priority until the client's budget is used up; rate.c sets each
+// client's budget, and how often it is sent snapshots, to suit its connection.
+// Priority accumulates on every tick that a player is left out, so nobody
+// starves.
+//
+// Both sides keep the last SNAPSHOT_HISTORY snapshots, indexed by sequence
+// number, so that whichever baseline the server picks, the client still has
+// it. If the client has not acknowledged anything recent enough, the server
+// encodes against an empty baseline instead.
+//
+//   u8 MESSAGE_SNAPSHOT
+//   16 bits sequence, 16 bits server tick, 1 bit has baseline,
+//   [16 bits baseline sequence], player count up to PLAYER_LIMIT,
+//   then for each changed player:
+//     1 bit set, index below player count, 5 bits field mask, then each field
+//   1 bit clear, then the client's own player:
+//   1 bit has input, [16 bits last input applied, x, y, walk, strafe as f32]
+//
+// The client's own player is sent at full precision, along with the input it
+// is the result of, so that the client can check its prediction against it.
+
+#define SNAPSHOT_HISTORY 32
+#define POSITION_FRACTION_BITS 8
+#define ANGLE_BITS 12
+#define SNAPSHOT_MAX_SIZE 1024
+#define SNAPSHOT_BYTE_BUDGET 128
+
+#define FIELD_X       (1 << 0)
+#define FIELD_Y       (1 << 1)
+#define FIELD_ANGLE   (1 << 2)
+#define FIELD_SPRITE  (1 << 3)
+#define FIELD_VISIBLE (1 << 4)
+#define FIELD_COUNT   5
+
+#define SPRITE_INDEX_BITS 8
+
+// Inputs the server holds for each client, indexed by sequence number.
+#define INPUT_BUFFER_SIZE 32
+
+typedef struct
+{
+    u32 x;
+    u32 y;
+    u32 angle;
+    u32 sprite_index;
+    u32 visible;
+}
+Entity_State;
+
+typedef struct
+{
+    u16 sequence;
+    // Low bits of the server's tick_count when the snapshot was taken.
+    u16 tick;
+    bool valid;
+    int entity_count;
+    // Room for player_capacity players, of which entity_count are used.
+    Entity_State * entities;
+}
+Snapshot;
+
+// Replication state the server keeps for each connected client. A client is
+// found from its peer through peer->data.
+typedef struct
+{
+    ENetPeer * peer;
+    u32 connect_id;
+    int player_index;
+    // Where the client is in clients.
+    int list_index;
+    Outbox outbox;
+    Peer_Telemetry telemetry;
+    Send_Rate rate;
+    Fire_Limit fire;
+    Snapshot sent[SNAPSHOT_HISTORY];
+    // Accumulated priority of each player's pending changes.
+    f32 * priority;
+    // Inputs received from the client, and the newest one applied so far.
+    Player_Input inputs[INPUT_BUFFER_SIZE];
+    u16 newest_input;
+    u16 applied_input;
+    bool has_input;
+    u16 next_sequence;
+    u16 acked_sequence;
+    bool has_acked;
+}
+Client;
+
+// The most bytes any one snapshot may hold.
+int snapshot_byte_budget = SNAPSHOT_BYTE_BUDGET;
+
+// Every connected client, in no particular order.
+MATCH_LOCAL Client ** clients;
+MATCH_LOCAL int client_count;
+// Every snapshot the server has sent, and their total size.
+MATCH_LOCAL u64 snapshots_sent;
+MATCH_LOCAL u64 snapshot_bytes_sent;
+
+// Snapshots a client has received from the server, and room to decode the
+// next one into before it is known to be good.
+MATCH_LOCAL Snapshot received_snapshots[SNAPSHOT_HISTORY];
+MATCH_LOCAL Entity_State * decoded_entities;
+MATCH_LOCAL u16 latest_snapshot_sequence;
+MATCH_LOCAL bool has_received_snapshot = false;
+
+// The server's word on where the client's own player is, as of an input.
+typedef struct
+{
+    u16 input;
+    f32 x;
+    f32 y;
+    f32 walk;
+    f32 strafe;
+}
+Authoritative_State;
+
+#define OWN_STATE_SCHEMA(BITS, RANGED, QUANTIZED, VARINT, FLAG, EXACT) \
+    BITS(input, 16) EXACT(x) EXACT(y) EXACT(walk) EXACT(strafe)
+
+DEFINE_SCHEMA(own_state, Authoritative_State, OWN_STATE_SCHEMA)
+
+MATCH_LOCAL Authoritative_State authoritative_state;
+MATCH_LOCAL bool has_authoritative_state = false;
+
+// Whether sequence number a is more recent than b, allowing for wrap around.
+bool sequence_newer(u16 a, u16 b)
+{
+    return (s16)(a - b) > 0;
+}
+
+int position_bits()
+{
+    return bits_for_count(max(map_width, map_height)) + POSITION_FRACTION_BITS;
+}
+
+// Positions are stored in fixed point, with POSITION_FRACTION_BITS of fraction.
+u32 quantize_position(f32 position)
+{
+    u32 largest = (1u << position_bits()) - 1;
+    u32 value = max(position, 0.0f) * (1 << POSITION_FRACTION_BITS) + 0.5f;
+    return min(value, largest);
+}
+
+f32 dequantize_position(u32 position)
+{
+    return position / (f32)(1 << POSITION_FRACTION_BITS);
+}
+
+u32 quantize_angle(f32 angle)
+{
+    return quantize_f32(angle, -PI, PI, ANGLE_BITS);
+}
+
+f32 dequantize_angle(u32 angle)
+{
+    return dequantize_f32(angle, -PI, PI, ANGLE_BITS);
+}
+
+Entity_State get_entity_state(int player_index)
+{
+    return (Entity_State){
+        .x = quantize_position(players.x[player_index]),
+        .y = quantize_position(players.y[player_index]),
+        .angle = quantize_angle(players.angle[player_index]),
+        .sprite_index = players.sprite_index[player_index],
+        .visible = true,
+    };
+}
+
+u32 entity_changes(Entity_State * state, Entity_State * base)
+{
+    return (state->x != base->x ? FIELD_X : 0)
+         | (state->y != base->y ? FIELD_Y : 0)
+         | (state->angle != base->angle ? FIELD_ANGLE : 0)
+         | (state->sprite_index != base->sprite_index ? FIELD_SPRITE : 0)
+         | (state->visible != base->visible ? FIELD_VISIBLE : 0);
+}
+
+// Number of bits that write_entity will use.
+int entity_bits(u32 mask, int index_bits)
+{
+    return 1 + index_bits + FIELD_COUNT
+         + (mask & FIELD_X       ? position_bits() : 0)
+         + (mask & FIELD_Y       ? position_bits() : 0)
+         + (mask & FIELD_ANGLE   ? ANGLE_BITS : 0)
+         + (mask & FIELD_SPRITE  ? SPRITE_INDEX_BITS : 0)
+         + (mask & FIELD_VISIBLE ? 1 : 0);
+}
+
+void write_entity(Bit_Writer * writer, int index, int index_bits, Entity_State * state, u32 mask)
+{
+    write_bool(writer, true);
+    write_bits(writer, index, index_bits);
+    write_bits(writer, mask, FIELD_COUNT);
+    if (mask & FIELD_X)       write_bits(writer, state->x, position_bits());
+    if (mask & FIELD_Y)       write_bits(writer, state->y, position_bits());
+    if (mask & FIELD_ANGLE)   write_bits(writer, state->angle, ANGLE_BITS);
+    if (mask & FIELD_SPRITE)  write_bits(writer, state->sprite_index, SPRITE_INDEX_BITS);
+    if (mask & FIELD_VISIBLE) write_bool(writer, state->visible);
+}
+
+typedef struct
+{
+    int index;
+    f32 priority;
+}
+Pending_Entity;
+
+// Highest priority first, and lowest index first among equals.
+int compare_priorities(const void * a, const void * b)
+{
+    const Pending_Entity * x = a;
+    const Pending_Entity * y = b;
+    if (x->priority != y->priority) return (x->priority < y->priority) - (x->priority > y->priority);
+    return x->index - y->index;
+}
+
+// Encode the current state of the players relevant to a client, as a delta
+// against its acknowledged baseline. What the client will know once it
+// receives this is stored as a future baseline.
+int write_snapshot(Client * client, u8 * buffer, int capacity)
+{
+    Snapshot * baseline = NULL;
+    Entity_State empty = {0};
+    if (client->has_acked)
+    {
+        baseline = client->sent + (client->acked_sequence % SNAPSHOT_HISTORY);
+        if (!baseline->valid || baseline->sequence != client->acked_sequence ||
+            (u16)(client->next_sequence - client->acked_sequence) >= SNAPSHOT_HISTORY)
+        {
+            baseline = NULL;
+        }
+    }
+
+    u16 sequence = client->next_sequence++;
+    Snapshot * snapshot = client->sent + (sequence % SNAPSHOT_HISTORY);
+
+    // Work out what the client should know about each player, and queue up
+    // those that differ from what it already knows. The client is told about
+    // its own player separately. Players added since the baseline start out
+    // as unknown, like everyone does without one.
+    Entity_State states[player_count];
+    u32 masks[player_count];
+    Pending_Entity pending[player_count];
+    int pending_count = 0;
+    for (int i = 0; i < player_count; ++i)
+    {
+        Entity_State * base = baseline && i < baseline->entity_count ? baseline->entities + i : &empty;
+        states[i] = *base;
+        snapshot->entities[i] = *base;
+        if (i == client->player_index) continue;
+
+        f32 interest = player_interest(client->player_index, i);
+        if (interest > 0.0f)
+        {
+            states[i] = get_entity_state(i);
+        }
+        else
+        {
+            // Hiding a player is cheap, so it should not wait its turn.
+            states[i].visible = false;
+            interest = 1.0f;
+        }
+
+        masks[i] = entity_changes(states + i, base);
+        if (masks[i])
+        {
+            client->priority[i] += interest;
+            pending[pending_count++] = (Pending_Entity){ .index = i, .priority = client->priority[i] };
+        }
+        else
+        {
+            client->priority[i] = 0.0f;
+        }
+    }
+    qsort(pending, pending_count, sizeof(Pending_Entity), compare_priorities);
+
+    buffer[0] = MESSAGE_SNAPSHOT;
+    Bit_Writer writer = make_bit_writer(buffer + 1, capacity - 1);
+    write_bits(&writer, sequence, 16);
+    write_bits(&writer, tick_count, 16);
+    write_bool(&writer, baseline != NULL);
+    if (baseline) write_bits(&writer, baseline->sequence, 16);
+    write_bits(&writer, player_count, bits_for_count(PLAYER_LIMIT + 1));
+    int index_bits = bits_for_count(player_count);
+
+    // Players that do not fit are left as they were in the baseline, and
+    // will be tried again next tick with a higher priority. Room is kept for
+    // what follows them: the terminating bit, and the client's own player.
+    int budget = min(client->rate.budget, capacity - 1) * 8 - 2 - (client->has_input ? own_state_bits() : 0);
+    for (int p = 0; p < pending_count; ++p)
+    {
+        int i = pending[p].index;
+        int bits = entity_bits(masks[i], index_bits);
+        if (writer.bit_count + bits > budget) continue;
+        write_entity(&writer, i, index_bits, states + i, masks[i]);
+        snapshot->entities[i] = states[i];
+        client->priority[i] = 0.0f;
+    }
+    write_bool(&writer, false);
+
+    write_bool(&writer, client->has_input);
+    if (client->has_input)
+    {
+        int i = client->player_index;
+        Authoritative_State own = {
+            .input = client->applied_input, .x = players.x[i], .y = players.y[i],
+            .walk = players.walk[i], .strafe = players.strafe[i],
+        };
+        write_own_state(&writer, &own);
+    }
+
+    snapshot->sequence = sequence;
+    snapshot->entity_count = player_count;
+    snapshot->valid = !writer.overflowed;
+    return writer.overflowed ? 0 : 1 + bit_writer_size(&writer);
+}
+
+// Decode a snapshot from the server and apply it to every remote player.
+// Players the server has stopped telling us about are hidden. Returns whether
+// the snapshot was new, in which case authoritative_state may be too.
+bool read_snapshot(u8 * data, int size)
+{
+    Bit_Reader reader = make_bit_reader(data + 1, size - 1);
+    u16 sequence = read_bits(&reader, 16);
+    u16 tick = read_bits(&reader, 16);
+    bool has_baseline = read_bool(&reader);
+    u16 baseline_sequence = has_baseline ? read_bits(&reader, 16) : 0;
+    int entity_count = read_bits(&reader, bits_for_count(PLAYER_LIMIT + 1));
+
+    // ENet already drops unreliable packets that arrive out of order, but a
+    // sequence from before a reconnect could still slip through.
+    if (has_received_snapshot && !sequence_newer(sequence, latest_snapshot_sequence)) return false;
+    if (reader.overflowed || entity_count < 1 || entity_count > PLAYER_LIMIT) return false;
+
+    Snapshot * reference = NULL;
+    if (has_baseline)
+    {
+        reference = received_snapshots + (baseline_sequence % SNAPSHOT_HISTORY);
+        // Without the baseline there is nothing to apply the delta to.
+        if (!reference->valid || reference->sequence != baseline_sequence) return false;
+    }
+
+    // A snapshot with more players than there is room for is decoded somewhere
+    // temporary, so that nothing grows until all of it is known to be good.
+    bool fits = entity_count <= player_capacity;
+    Entity_State spare[fits ? 1 : entity_count];
+    Entity_State * entities = fits ? decoded_entities : spare;
+    for (int i = 0; i < entity_count; ++i)
+    {
+        bool known = reference && i < reference->entity_count;
+        entities[i] = known ? reference->entities[i] : (Entity_State){0};
+    }
+    int index_bits = bits_for_count(entity_count);
+    while (read_bool(&reader))
+    {
+        int i = read_bits(&reader, index_bits);
+        if (i >= entity_count) return false;
+        Entity_State * state = entities + i;
+        u32 mask = read_bits(&reader, FIELD_COUNT);
+        if (mask & FIELD_X)       state->x = read_bits(&reader, position_bits());
+        if (mask & FIELD_Y)       state->y = read_bits(&reader, position_bits());
+        if (mask & FIELD_ANGLE)   state->angle = read_bits(&reader, ANGLE_BITS);
+        if (mask & FIELD_SPRITE)  state->sprite_index = read_bits(&reader, SPRITE_INDEX_BITS);
+        if (mask & FIELD_VISIBLE) state->visible = read_bool(&reader);
+    }
+
+    Authoritative_State own = {0};
+    bool has_own = read_bool(&reader);
+    if (has_own) read_own_state(&reader, &own);
+    if (reader.overflowed) return false;
+    // Every other field is bounded by its bits, but these are taken as sent.
+    if (has_own && (!position_in_map(own.x, own.y) || !isfinite(own.walk) || !isfinite(own.strafe))) return false;
+
+    set_player_count(entity_count);
+    if (!fits)
+    {
+        memcpy(decoded_entities, spare, entity_count * sizeof(Entity_State));
+        entities = decoded_entities;
+    }
+
+    // Keep the decoded snapshot, and decode the next one over the oldest.
+    Snapshot * snapshot = received_snapshots + (sequence % SNAPSHOT_HISTORY);
+    decoded_entities = snapshot->entities;
+    *snapshot = (Snapshot){
+        .sequence = sequence, .tick = tick, .valid = true,
+        .entity_count = entity_count, .entities = entities,
+    };
+    latest_snapshot_sequence = sequence;
+    has_received_snapshot = true;
+    if (has_own)
+    {
+        authoritative_state = own;
+        has_authoritative_state = true;
+    }
+
+    for (int i = 0; i < min(entity_count, player_count); ++i)
+    {
+        if (i == local_player) continue;
+        Entity_State * state = entities + i;
+        players.hidden[i] = !state->visible;
+        if (players.hidden[i]) continue;
+        players.x[i] = dequantize_position(state->x);
+        players.y[i] = dequantize_position(state->y);
+        set_player_angle(i, dequantize_angle(state->angle));
+        players.sprite_index[i] = state->sprite_index;
+        players.walk[i] = players.strafe[i] = 0.0f;
+    }
+    return true;
+}
+
+void resize_client_snapshots(int capacity)
+{
+    for (int c = 0; c < client_count; ++c)
+    {
+        Client * client = clients[c];
+        for (int i = 0; i < SNAPSHOT_HISTORY; ++i)
+        {
+            Snapshot * snapshot = client->sent + i;
+            snapshot->entities = resize_player_array(snapshot->entities, sizeof(Entity_State), player_capacity, capacity);
+        }
+        client->priority = resize_player_array(client->priority, sizeof(f32), player_capacity, capacity);
+    }
+    for (int i = 0; i < SNAPSHOT_HISTORY; ++i)
+    {
+        Snapshot * snapshot = received_snapshots + i;
+        snapshot->entities = resize_player_array(snapshot->entities, sizeof(Entity_State), player_capacity, capacity);
+    }
+    decoded_entities = resize_player_array(decoded_entities, sizeof(Entity_State), player_capacity, capacity);
+    // There is never more than one client per player.
+    clients = resize_player_array(clients, sizeof(Client *), player_capacity, capacity);
+}
+
+// A client that is not yet one of clients; the benchmark in bitbench.c makes
+// these to write snapshots with.
+Client * create_client(ENetPeer * peer, u32 connect_id, int player_index)
+{
+    Client * client = calloc(1, sizeof(Client));
+    assert(client);
+    client->peer = peer;
+    client->connect_id = connect_id;
+    client->player_index = player_index;
+    reset_outbox(&client->outbox, peer, connect_id);
+    client->rate = (Send_Rate){ .interval = snapshot_interval, .budget = snapshot_byte_budget };
+    for (int i = 0; i < SNAPSHOT_HISTORY; ++i)
+    {
+        client->sent[i].entities = resize_player_array(NULL, sizeof(Entity_State), 0, player_capacity);
+    }
+    client->priority = resize_player_array(NULL, sizeof(f32), 0, player_capacity);
+    return client;
+}
+
+void destroy_client(Client * client)
+{
+    reset_outbox(&client->outbox, NULL, 0);
+    for (int i = 0; i < SNAPSHOT_HISTORY; ++i)
+    {
+        free(client->sent[i].entities);
+    }
+    free(client->priority);
+    free(client);
+}
+
+Client * add_client(ENetPeer * peer, u32 connect_id, int player_index)
+{
+    Client * client = create_client(peer, connect_id, player_index);
+    client->list_index = client_count;
+    clients[client_count++] = client;
+    return client;
+}
+
+void remove_client(Client * client)
+{
+    Client * last = clients[--client_count];
+    clients[client->list_index] = last;
+    last->list_index = client->list_index;
+    destroy_client(client);
+}
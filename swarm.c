@@ -0,0 +1,358 @@
+/*
+    Labyrinth
+    Benedict Henshaw, 2018
+    swarm.c - Loading a local server with simulated clients.
+*/
+
+// "--swarm count" runs a headless server, then connects count clients to it
+// over loopback from a thread of their own, each with its own ENet host. They
+// speak the real protocol: every tick they send scripted inputs, acknowledge
+// the snapshots they receive, and every so often chat and fire. They also
+// ping the server, which sends each ping straight back through the client's
+// outbox, so the time taken includes the wait for the server's next tick.
+//
+// After "--duration" seconds the swarm stops and reports, as percentiles:
+// round trip times, how far snapshots arrive from their expected spacing,
+// bytes each client sent and received per second, and how long each of the
+// server's ticks took to simulate and send, along with what became of the
+// clients' shots. The rates of input, chat and fire are set with
+// "--input-rate", "--chat-rate" and "--fire-rate", all per client per second.
+//
+// The swarm's thread waits on all of its hosts at once in a reactor, and
+// services only those with something to do.
+//
+// With "--netsim profile" the server's host simulates that profile, which
+// then applies to every client of the swarm in both directions.
+//
+// With "--matches", the clients are shared out between every match, though
+// only the main match's ticks are timed, and its shots counted.
+//
+// The swarm's hosts share the compressor with the server's, so their traffic
+// is counted in the compression stats too.
+
+#define SWARM_PING_RATE 10
+// Inputs sent in each message, as a real client with a short round trip would.
+#define SWARM_INPUT_REDUNDANCY 2
+
+typedef struct
+{
+    ENetHost * host;
+    ENetPeer * peer;
+    Reactor_Host * reactor_host;
+    // Until the server welcomes the client, it is not sent any input.
+    bool welcomed;
+    bool disconnected;
+    Player_Input inputs[INPUT_HISTORY];
+    u16 next_input;
+    int input_count;
+    f32 angle;
+    u16 latest_snapshot;
+    u16 latest_snapshot_tick;
+    bool has_snapshot;
+    f64 last_snapshot_time;
+    f64 input_credit;
+    f64 chat_credit;
+    int chat_count;
+    f64 fire_credit;
+}
+Swarm_Client;
+
+typedef struct
+{
+    f32 * values;
+    int count;
+    int capacity;
+}
+Sample_Set;
+
+int swarm_size = 0;
+f64 swarm_duration = 30.0;
+f64 swarm_input_rate = TICK_RATE;
+f64 swarm_chat_rate = 0.5;
+f64 swarm_fire_rate = 1.0;
+// Clients are shared out between this many matches, on consecutive ports.
+int swarm_match_count = 1;
+
+Swarm_Client * swarm_clients;
+SDL_Thread * swarm_thread;
+SDL_atomic_t swarm_thread_running;
+bool swarm_running = false;
+f64 swarm_start_time;
+
+// Written only by the swarm thread until it has stopped.
+Sample_Set round_trip_times;
+Sample_Set snapshot_jitters;
+int swarm_kills_seen;
+// Written only by the game thread.
+Sample_Set server_tick_times;
+
+void add_sample(Sample_Set * set, f32 value)
+{
+    if (set->count == set->capacity)
+    {
+        set->capacity = max(1024, set->capacity * 2);
+        set->values = realloc(set->values, set->capacity * sizeof(f32));
+        assert(set->values);
+    }
+    set->values[set->count++] = value;
+}
+
+int compare_samples(const void * a, const void * b)
+{
+    f32 x = *(const f32 *)a;
+    f32 y = *(const f32 *)b;
+    return (x > y) - (x < y);
+}
+
+void print_percentiles(char * name, Sample_Set * set, char * unit)
+{
+    if (set->count == 0)
+    {
+        push_console_string("%-18s no samples", name);
+        return;
+    }
+    qsort(set->values, set->count, sizeof(f32), compare_samples);
+    f32 * v = set->values;
+    int n = set->count;
+    push_console_string("%-18s p50 %7.2f  p90 %7.2f  p99 %7.2f  max %7.2f %s  (%d)", name,
+        v[n / 2], v[n * 9 / 10], v[n * 99 / 100], v[n - 1], unit, n);
+}
+
+void send_swarm_message(Swarm_Client * client, int channel, u8 * data, int size)
+{
+    u32 flags = channel_policies[channel].packet_flags;
+    if (enet_peer_send(client->peer, channel, enet_packet_create(data, size, flags)) != 0)
+    {
+        // ENet only takes the packet if it could be queued.
+        client->disconnected = true;
+    }
+}
+
+void handle_swarm_message(Swarm_Client * client, u8 * data, int size, f64 now)
+{
+    if (size < 1) return;
+    if (data[0] == MESSAGE_WELCOME)
+    {
+        client->welcomed = true;
+    }
+    else if (data[0] == MESSAGE_SNAPSHOT)
+    {
+        Bit_Reader reader = make_bit_reader(data + 1, size - 1);
+        u16 sequence = read_bits(&reader, 16);
+        u16 tick = read_bits(&reader, 16);
+        if (reader.overflowed) return;
+        if (client->has_snapshot && !sequence_newer(sequence, client->latest_snapshot)) return;
+
+        if (client->has_snapshot)
+        {
+            f64 expected = (u16)(tick - client->latest_snapshot_tick) * (f64)TICK_DURATION;
+            add_sample(&snapshot_jitters, fabs(now - client->last_snapshot_time - expected) * 1000.0);
+        }
+        client->latest_snapshot = sequence;
+        client->latest_snapshot_tick = tick;
+        client->has_snapshot = true;
+        client->last_snapshot_time = now;
+    }
+    else if (data[0] == MESSAGE_KILL)
+    {
+        ++swarm_kills_seen;
+    }
+    else if (data[0] == MESSAGE_PONG && size == 1 + sizeof(f64))
+    {
+        f64 sent;
+        memcpy(&sent, data + 1, sizeof(sent));
+        add_sample(&round_trip_times, (now - sent) * 1000.0);
+    }
+}
+
+// Send what a client has to send on one tick.
+void step_swarm_client(Swarm_Client * client, int index, u64 tick, f64 now)
+{
+    u8 message[SNAPSHOT_MAX_SIZE];
+
+    client->input_credit += swarm_input_rate * TICK_DURATION;
+    while (client->input_credit >= 1.0)
+    {
+        client->input_credit -= 1.0;
+        // Mostly walk forwards, weaving from side to side and turning
+        // steadily, with each client out of step with the others.
+        u64 phase = tick + index * 37;
+        Player_Input input = { .sequence = client->next_input++ };
+        if (phase % 180 < 150)  input.buttons |= INPUT_UP;
+        if (phase % 120 < 30)   input.buttons |= INPUT_LEFT;
+        else if (phase % 120 >= 90) input.buttons |= INPUT_RIGHT;
+        client->angle = remainderf(client->angle + (index % 2 ? 0.02f : -0.02f), TWO_PI);
+        input.angle = client->angle;
+        client->inputs[input.sequence % INPUT_HISTORY] = input;
+        client->input_count = min(client->input_count + 1, INPUT_HISTORY);
+
+        int size = write_input_message(message, sizeof(message), client->has_snapshot, client->latest_snapshot,
+            client->inputs, input.sequence, min(client->input_count, SWARM_INPUT_REDUNDANCY));
+        if (size) send_swarm_message(client, CHANNEL_UNRELIABLE, message, size);
+    }
+
+    client->chat_credit += swarm_chat_rate * TICK_DURATION;
+    while (client->chat_credit >= 1.0)
+    {
+        client->chat_credit -= 1.0;
+        message[0] = MESSAGE_CHAT;
+        int length = snprintf((char *)message + 1, sizeof(message) - 1, "Swarm client %d says hello %d.",
+            index, client->chat_count++);
+        send_swarm_message(client, CHANNEL_RELIABLE, message, 1 + length);
+    }
+
+    client->fire_credit += swarm_fire_rate * TICK_DURATION;
+    while (client->fire_credit >= 1.0)
+    {
+        client->fire_credit -= 1.0;
+        // Aimed as a client with an average interpolation delay would be.
+        Shot_Intent intent = { .input = client->next_input, .angle = client->angle, .delay = 50 };
+        int size = write_shot(message, sizeof(message), &intent);
+        if (size) send_swarm_message(client, CHANNEL_RELIABLE, message, size);
+    }
+
+    if (tick % (TICK_RATE / SWARM_PING_RATE) == (u64)index % (TICK_RATE / SWARM_PING_RATE))
+    {
+        message[0] = MESSAGE_PING;
+        memcpy(message + 1, &now, sizeof(now));
+        send_swarm_message(client, CHANNEL_UNSEQUENCED, message, 1 + sizeof(now));
+    }
+}
+
+void service_swarm_client(Swarm_Client * client)
+{
+    ENetEvent event;
+    while (enet_host_service(client->host, &event, 0) > 0)
+    {
+        if (event.type == ENET_EVENT_TYPE_RECEIVE)
+        {
+            f64 now = get_seconds();
+            Message_Reader reader = make_message_reader(event.packet->data, event.packet->dataLength);
+            u8 * message;
+            int size;
+            while (next_message(&reader, &message, &size)) handle_swarm_message(client, message, size, now);
+            enet_packet_destroy(event.packet);
+        }
+        else if (event.type != ENET_EVENT_TYPE_CONNECT)
+        {
+            client->disconnected = true;
+        }
+    }
+    schedule_reactor_host(client->reactor_host);
+}
+
+int run_swarm_thread(void * data)
+{
+    u16 port = *(u16 *)data;
+    Reactor reactor;
+    init_reactor(&reactor);
+    for (int i = 0; i < swarm_size; ++i)
+    {
+        Swarm_Client * client = swarm_clients + i;
+        ENetAddress address = { .port = port + i % swarm_match_count };
+        enet_address_set_host(&address, "127.0.0.1");
+        client->host = enet_host_create(NULL, 1, CHANNEL_COUNT, 0, 0);
+        if (!client->host) panic_exit("Could not create swarm client %d.", i);
+        install_compressor(client->host);
+        client->peer = enet_host_connect(client->host, &address, CHANNEL_COUNT, 0);
+        if (!client->peer) panic_exit("Could not connect swarm client %d.", i);
+        client->reactor_host = add_reactor_host(&reactor, client->host, client);
+    }
+
+    f64 next_tick_time = get_seconds();
+    u64 tick = 0;
+    while (SDL_AtomicGet(&swarm_thread_running))
+    {
+        // Sleep until a client has something to do, or the next tick.
+        f64 until_tick = next_tick_time - get_seconds();
+        int ready = wait_reactor(&reactor, until_tick > 0.0 ? (u32)ceil(until_tick * 1000.0) : 0);
+        for (int i = 0; i < ready; ++i)
+        {
+            service_swarm_client(reactor.ready[i]->data);
+        }
+
+        f64 now = get_seconds();
+        if (now >= next_tick_time)
+        {
+            for (int i = 0; i < swarm_size; ++i)
+            {
+                Swarm_Client * client = swarm_clients + i;
+                if (client->welcomed && !client->disconnected) step_swarm_client(client, i, tick, now);
+                enet_host_flush(client->host);
+                schedule_reactor_host(client->reactor_host);
+            }
+            ++tick;
+            next_tick_time += TICK_DURATION;
+            // Do not try to catch up after falling far behind.
+            if (now - next_tick_time > MAX_FRAME_TIME) next_tick_time = now;
+        }
+    }
+
+    for (int i = 0; i < swarm_size; ++i)
+    {
+        enet_peer_disconnect_now(swarm_clients[i].peer, 0);
+    }
+    destroy_reactor(&reactor);
+    return 0;
+}
+
+// Launch a server on the given port and connect the swarm to it.
+void start_swarm(int port)
+{
+    static u16 swarm_port;
+    swarm_port = port ? port : DEFAULT_PORT;
+    create_network(swarm_port);
+
+    swarm_clients = calloc(swarm_size, sizeof(Swarm_Client));
+    assert(swarm_clients);
+    SDL_AtomicSet(&swarm_thread_running, 1);
+    swarm_thread = SDL_CreateThread(run_swarm_thread, "swarm", &swarm_port);
+    if (!swarm_thread) panic_exit("Could not start the swarm thread.");
+    swarm_running = true;
+    swarm_start_time = get_seconds();
+    push_console_string("Swarm of %d clients started for %.0f seconds.", swarm_size, swarm_duration);
+}
+
+void record_server_tick(f64 seconds)
+{
+    add_sample(&server_tick_times, seconds * 1000.0);
+}
+
+// Once the time is up, stop the swarm, report on how the server coped, and exit.
+void update_swarm()
+{
+    if (!swarm_running || get_seconds() - swarm_start_time < swarm_duration) return;
+
+    SDL_AtomicSet(&swarm_thread_running, 0);
+    SDL_WaitThread(swarm_thread, NULL);
+    swarm_running = false;
+
+    int welcomed = 0;
+    Sample_Set sent_rates = {0};
+    Sample_Set received_rates = {0};
+    for (int i = 0; i < swarm_size; ++i)
+    {
+        Swarm_Client * client = swarm_clients + i;
+        if (client->welcomed)
+        {
+            ++welcomed;
+            add_sample(&sent_rates, client->host->totalSentData / swarm_duration);
+            add_sample(&received_rates, client->host->totalReceivedData / swarm_duration);
+        }
+        enet_host_destroy(client->host);
+    }
+
+    push_console_string("Swarm: %d of %d clients joined, %d ticks.",
+        welcomed, swarm_size, server_tick_times.count);
+    print_percentiles("Round trip", &round_trip_times, "ms");
+    print_percentiles("Snapshot jitter", &snapshot_jitters, "ms");
+    print_percentiles("Server tick", &server_tick_times, "ms");
+    print_percentiles("Client bytes out", &sent_rates, "B/s");
+    print_percentiles("Client bytes in", &received_rates, "B/s");
+    print_host_telemetry();
+    combat_command();
+    push_console_string("  Kill events received by clients: %d", swarm_kills_seen);
+    if (netsim_active()) print_netsim();
+    destroy_local_host();
+    exit(0);
+}